@@ -0,0 +1,45 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <algorithm>
+
+Arena::Arena(size_t blockSize) : blockSize(blockSize) {}
+
+void Arena::addBlock(size_t size)
+{
+    blocks.emplace_back(new char[size]);
+    cur = blocks.back().get();
+    left = size;
+    capacity += size;
+}
+
+void* Arena::Allocate(size_t size, size_t align)
+{
+    auto pad = (align - uintptr_t(cur) % align) % align;
+    if (cur == nullptr || pad + size > left) {
+	// Blocks grow so that a large round needs few of them.
+	auto next = std::max(blockSize, capacity);
+	addBlock(std::max(next, size + align));
+	pad = (align - uintptr_t(cur) % align) % align;
+    }
+    auto p = cur + pad;
+    cur += pad + size;
+    left -= pad + size;
+    used += size;
+    return p;
+}
+
+void Arena::Reset()
+{
+    if (blocks.size() > 1) {
+	auto total = capacity;
+	blocks.clear();
+	capacity = 0;
+	addBlock(total);
+    }
+    else if (!blocks.empty()) {
+	cur = blocks.back().get();
+	left = capacity;
+    }
+    used = 0;
+}
@@ -0,0 +1,85 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stddef.h>
+#include <memory>
+#include <new>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+/// Monotonic allocator for short-lived data of a batch or a query. Memory
+/// is handed out from large blocks and only given back by Reset, which
+/// keeps a single block big enough for the previous round.
+class Arena {
+public:
+    explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t align);
+    /// Release everything allocated since the last Reset. Containers using
+    /// the arena must be gone by then.
+    void Reset();
+    /// Bytes handed out since the last Reset.
+    size_t Used() const { return used; }
+    /// Bytes held in blocks.
+    size_t Capacity() const { return capacity; }
+
+private:
+    void addBlock(size_t size);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t blockSize;
+    char* cur{nullptr};
+    size_t left{0};
+    size_t used{0};
+    size_t capacity{0};
+};
+
+/// Standard allocator drawing from an Arena, or from the heap when it has
+/// none. Deallocation is a no-op for arena memory.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.Owner())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+	if (arena == nullptr) {
+	    return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t)
+    {
+	if (arena == nullptr) {
+	    ::operator delete(p);
+	}
+    }
+    Arena* Owner() const { return arena; }
+
+private:
+    Arena* arena{nullptr};
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.Owner() == b.Owner();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.Owner() != b.Owner();
+}
+
+#endif
@@ -31,6 +31,13 @@ struct CmdArgs* ParseArgsSort(int argc, char* argv[])
 	{"outfolder", required_argument, 0, 'o'},
 	{"batch-size", required_argument, 0, 'B'},
 	{"batch-max-seq", required_argument, 0, 'M'},
+	{"mem-budget", required_argument, 0, 'S'},
+	{"batches-in-flight", required_argument, 0, 'I'},
+	{"export-fastq", no_argument, 0, 'E'},
+	{"compress-batches", required_argument, 0, 'z'},
+	{"batch-quals", required_argument, 0, 'Q'},
+	{"canonical-mins", no_argument, 0, 'C'},
+	{"hash-mins", no_argument, 0, 'H'},
 	{0, 0, 0, 0},
     };
 
@@ -47,7 +54,7 @@ struct CmdArgs* ParseArgsSort(int argc, char* argv[])
 
     while (iarg != -1) {
 	iarg = getopt_long(argc, sargv,
-			   "k:w:dhvo:m:r:a:f:p:q:B:x:g:c:M:P:F:", longopts,
+			   "k:w:dhvECHo:m:r:a:f:p:q:B:x:g:c:M:P:F:S:I:z:Q:", longopts,
 			   &index);
 
 	switch (iarg) {
@@ -85,6 +92,42 @@ struct CmdArgs* ParseArgsSort(int argc, char* argv[])
 	    case 'M':
 		res->BatchMaxSeq = atoi(optarg);
 		break;
+	    case 'S':
+		res->MemBudget = atoi(optarg);
+		break;
+	    case 'I':
+		res->BatchesInFlight = atoi(optarg);
+		break;
+	    case 'E':
+		res->ExportFastq = true;
+		break;
+	    case 'C':
+		res->CanonicalMins = true;
+		break;
+	    case 'H':
+		res->HashMins = true;
+		break;
+	    case 'z':
+		res->BatchCompression = atoi(optarg);
+		break;
+	    case 'Q': {
+		string q = string(optarg);
+		if (q == "full") {
+		    res->BatchQual = QualFull;
+		}
+		else if (q == "binned") {
+		    res->BatchQual = QualBinned;
+		}
+		else if (q == "drop") {
+		    res->BatchQual = QualNone;
+		}
+		else {
+		    cerr << "Illegal batch quality mode: " << q << endl;
+		    print_help_sort();
+		    exit(1);
+		}
+		break;
+	    }
 	    case 'P':
 		res->ConsPeriod = atoi(optarg);
 		break;
@@ -127,8 +170,14 @@ struct CmdArgs* ParseArgsSort(int argc, char* argv[])
 	}
     }
 
-    if (argc - optind != 1) {
-	cerr << "Please specify one input fastq file!" << endl;
+    if (argc - optind < 1) {
+	cerr << "Please specify at least one input fastq file or directory!"
+	     << endl;
+	exit(1);
+    }
+
+    if (res->BatchCompression < 0 || res->BatchCompression > 9) {
+	cerr << "Batch compression level must be between 0 and 9!" << endl;
 	exit(1);
     }
 
@@ -147,7 +196,10 @@ struct CmdArgs* ParseArgsSort(int argc, char* argv[])
 	exit(1);
     }
 
-    res->InFastq = sargv[optind];
+    for (int i = optind; i < argc; i++) {
+	res->InFastqs.push_back(sargv[i]);
+	res->InFastq += (i > optind ? " " : "") + std::string(sargv[i]);
+    }
     return res;
 }
 
@@ -160,6 +212,7 @@ struct CmdArgsCluster* ParseArgsCluster(int argc, char* argv[])
 	{"verbose", no_argument, 0, 'v'},
 	{"min-purge", no_argument, 0, 'z'},
 	{"min-cls-size", required_argument, 0, 'F'},
+	{"mask-mins", required_argument, 0, 'X'},
 	{"keep-seq", no_argument, 0, 'j'},
 	{"debug", no_argument, 0, 'd'},
 	{"spoa-algo", optional_argument, 0, 'A'},
@@ -184,7 +237,7 @@ struct CmdArgsCluster* ParseArgsCluster(int argc, char* argv[])
 
     while (iarg != -1) {
 	iarg =
-	    getopt_long(argc, sargv, "Vdhvo:l:r:Qx:A:zjF:", longopts, &index);
+	    getopt_long(argc, sargv, "Vdhvo:l:r:Qx:A:zjF:X:", longopts, &index);
 
 	switch (iarg) {
 	    case 'h':
@@ -221,6 +274,9 @@ struct CmdArgsCluster* ParseArgsCluster(int argc, char* argv[])
 	    case 'F':
 		res->MinClsSize = atoi(optarg);
 		break;
+	    case 'X':
+		res->MaskMins = atof(optarg);
+		break;
 	    case 'x':
 		string m = string(optarg);
 		if (m == mSahlin) {
@@ -254,6 +310,11 @@ struct CmdArgsCluster* ParseArgsCluster(int argc, char* argv[])
 	exit(1);
     }
 
+    if (res->MaskMins < 0.0) {
+	cerr << "Minimizer masking cutoff cannot be negative!" << endl;
+	exit(1);
+    }
+
     return res;
 }
 
@@ -369,10 +430,26 @@ void print_help_sort()
 	   "left batch (default: 3).\n"
 	   "\t-o --outfolder         Output folder (default: "
 	   "\t./isONclust2_batches).\n"
+	   "\t-S --mem-budget        Memory budget in megabytes, sort in runs "
+	   "spilled to disk (default: 0, sort in memory).\n"
+	   "\t-I --batches-in-flight Maximum number of batches prepared "
+	   "concurrently (default: 0, number of cores), capped to fit the "
+	   "memory budget.\n"
+	   "\t-E --export-fastq      Also write the sorted reads as fastq.\n"
+	   "\t-z --compress-batches  Compress batch files with this zlib "
+	   "level, inherited by merged batches (default: 0, off).\n"
+	   "\t-Q --batch-quals       Read qualities kept in batches: full, "
+	   "binned or drop (default: drop, dump takes them from the sorted "
+	   "reads).\n"
+	   "\t-C --canonical-mins    Use strand independent canonical "
+	   "minimizers, a single lookup per minimizer.\n"
+	   "\t-H --hash-mins         Order minimizers by a hash of the k-mers "
+	   "instead of their bases.\n"
 	   "\t-h --help              Print help.\n"
 	   "\t-v --verbose           Verbose output.\n"
 	   "\t-d --debug             Print debug info.\n"
-	   "\t[positional argument]  Input fastq file (required).\n";
+	   "\t[positional arguments] Input fastq files or directories of fastq "
+	   "files, optionally gzip or BGZF compressed (required).\n";
 }
 
 void print_help_cluster()
@@ -392,10 +469,13 @@ void print_help_cluster()
 	    "\t           * 2 : semi-global\n"
 	    "\t-z --min-purge         Purge minimizer database from output "
 	    "batch.\n"
-	    "\t-j --keep-seq          Do not purge non-representative "
-	    "sequences from output batches.\n"
+	    "\t-j --keep-seq          Ignored, member reads are kept in the "
+	    "read store.\n"
 	    "\t-F --min-cls-size      Skip clusters smaller than this in the "
 	    "left batch.\n"
+	    "\t-X --mask-mins         Skip minimizers in more clusters than this "
+	    "when looking up reads, or below 1 the fraction of the most frequent "
+	    "minimizers to skip (default: 0, off).\n"
 	    "\t-v --verbose           Verbose output.\n"
 	    "\t-Q --quiet             Supress progress bar.\n"
 	    "\t-d --debug             Print debug info.\n"
@@ -452,6 +532,12 @@ bool operator==(const CmdArgs& lhs, const CmdArgs& rgh)
     if (lhs.MinFraction != rgh.MinFraction) {
 	return false;
     }
+    if (lhs.CanonicalMins != rgh.CanonicalMins) {
+	return false;
+    }
+    if (lhs.HashMins != rgh.HashMins) {
+	return false;
+    }
 
     return true;
 }
@@ -1,8 +1,10 @@
 #ifndef ARGS_H_INCLUDED
 #define ARGS_H_INCLUDED
 #include "isONclust2_config.h"
+#include "qual_store.h"
 
 #include <string>
+#include <vector>
 
 typedef enum { Sahlin, Fast, Furious, None } ClsMode;
 
@@ -26,13 +28,25 @@ struct CmdArgs {
     double MinProbNoHits{0.1};
     std::string BatchOutFolder{"isONclust2_batches"};
     ClsMode Mode{Sahlin};
+    int BatchCompression{0};
+    QualKind BatchQual{QualNone};
+    bool CanonicalMins{};
+    bool HashMins{};
+    // Not serialized: batches must not depend on how the reads were sorted.
+    int MemBudget{0};
+    int BatchesInFlight{0};
+    bool ExportFastq{};
+    // Minimizer masking of the current merge, set from the cluster options.
+    double MaskMins{0.0};
+    std::vector<std::string> InFastqs;
     template <class Archive>
     void serialize(Archive& archive)
     {
 	archive(Verbose, Debug, InFastq, KmerSize, BatchSize, BatchMaxSeq,
 		WindowSize, MinShared, ConsMinSize, ConsMaxSize, ConsPeriod,
 		MinClsSize, MinQual, MappedThreshold, AlignedThreshold,
-		MinFraction, MinProbNoHits, BatchOutFolder, Mode);
+		MinFraction, MinProbNoHits, BatchOutFolder, Mode,
+		BatchCompression, BatchQual, CanonicalMins, HashMins);
     }
 };
 
@@ -46,6 +60,7 @@ struct CmdArgsCluster {
     bool MinPurge{};
     bool SeqPurge{};
     int MinClsSize{-1};
+    double MaskMins{0.0};
     std::string LeftCereal{""};
     std::string RightCereal{""};
     std::string OutCereal{""};
@@ -0,0 +1,620 @@
+#include "batch_file.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+
+#include "out_buffer.h"
+#include "tbb/parallel_for.h"
+#include "zlib.h"
+
+/// Input stream buffer over mapped bytes, for the cereal parts.
+class memBuf : public std::streambuf {
+public:
+    memBuf(const char* data, size_t size)
+    {
+	auto p = const_cast<char*>(data);
+	setg(p, p, p + size);
+    }
+};
+
+static inline uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+static void saveMeta(const Batch& b, std::string& out)
+{
+    std::ostringstream os;
+    {
+	cereal::BinaryOutputArchive archive(os);
+	archive(b.BatchNr, b.BatchStart, b.BatchEnd, b.BatchBases,
+		b.TotalReads, b.NrCls, b.SortArgs, b.LeftLeaf, b.RightLeaf,
+		b.Depth);
+    }
+    out = os.str();
+}
+
+/// Sequential writer keeping track of the file position and the sections.
+/// Packed sections are compressed a few blocks at a time, in parallel.
+class flatWriter {
+public:
+    flatWriter(const std::string& outFile, int level)
+	: path(outFile), level(level)
+    {
+	out.Open(outFile, true);
+	// The header is rewritten by Finish.
+	BatchFileHeader h;
+	memset(&h, 0, sizeof(h));
+	writeOut(&h, sizeof(h));
+    }
+    void Write(const void* data, size_t len)
+    {
+	rawSize += len;
+	if (!packing) {
+	    writeOut(data, len);
+	    return;
+	}
+	pending.append(static_cast<const char*>(data), len);
+	if (pending.size() >= 16 * BATCH_BLOCK_SIZE) {
+	    packBlocks(false);
+	}
+    }
+    template <typename T>
+    void Put(const T& v)
+    {
+	Write(&v, sizeof(T));
+    }
+    void Begin(uint32_t id, uint64_t count, bool pack = true)
+    {
+	pad();
+	BatchSection s;
+	memset(&s, 0, sizeof(s));
+	s.Id = id;
+	s.Offset = pos;
+	s.Count = count;
+	packing = pack && level > 0;
+	s.Codec = (packing ? CodecZlib : CodecRaw);
+	sections.push_back(s);
+	rawSize = 0;
+    }
+    void End()
+    {
+	if (packing) {
+	    packBlocks(true);
+	    writeOut(blockSizes.data(), blockSizes.size() * sizeof(uint32_t));
+	    blockSizes.clear();
+	    packing = false;
+	}
+	auto& s = sections.back();
+	s.Size = pos - s.Offset;
+	s.RawSize = rawSize;
+    }
+    void Finish()
+    {
+	pad();
+	BatchFileHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.Magic, BATCH_FILE_MAGIC, sizeof(h.Magic));
+	h.Version = BATCH_FILE_VERSION;
+	h.NrSections = uint32_t(sections.size());
+	h.TableOffset = pos;
+	writeOut(sections.data(), sections.size() * sizeof(BatchSection));
+	out.Close();
+
+	auto fh = fopen(path.c_str(), "r+b");
+	if (fh == nullptr || fwrite(&h, 1, sizeof(h), fh) != sizeof(h) ||
+	    fclose(fh) != 0) {
+	    std::cerr << "Failed to write " + path + "!" << std::endl;
+	    exit(1);
+	}
+    }
+
+private:
+    void writeOut(const void* data, size_t len)
+    {
+	out.Write(static_cast<const char*>(data), len);
+	pos += len;
+    }
+    void pad()
+    {
+	static const char zeros[8] = {};
+	writeOut(zeros, size_t(align8(pos) - pos));
+    }
+    // Compress the full blocks, and the partial one at the end of a section.
+    void packBlocks(bool last)
+    {
+	size_t nrBlocks = pending.size() / BATCH_BLOCK_SIZE;
+	if (last && pending.size() % BATCH_BLOCK_SIZE > 0) {
+	    nrBlocks++;
+	}
+	std::vector<std::string> blocks(nrBlocks);
+	tbb::parallel_for(size_t(0), nrBlocks, [&](size_t i) {
+	    auto start = i * BATCH_BLOCK_SIZE;
+	    auto len = std::min(size_t(BATCH_BLOCK_SIZE), pending.size() - start);
+	    uLongf compLen = compressBound(uLong(len));
+	    blocks[i].resize(compLen);
+	    compress2(reinterpret_cast<Bytef*>(&blocks[i][0]), &compLen,
+		      reinterpret_cast<const Bytef*>(pending.data() + start),
+		      uLong(len), level);
+	    blocks[i].resize(compLen);
+	});
+	for (auto& b : blocks) {
+	    writeOut(b.data(), b.size());
+	    blockSizes.push_back(uint32_t(b.size()));
+	}
+	pending.erase(0, std::min(pending.size(), nrBlocks * BATCH_BLOCK_SIZE));
+    }
+
+    std::string path;
+    int level;
+    OutBuffer out;
+    uint64_t pos{0};
+    std::vector<BatchSection> sections;
+    bool packing{false};
+    uint64_t rawSize{0};
+    std::string pending;
+    std::vector<uint32_t> blockSizes;
+};
+
+static void flatSeq(const SeqUptr& s, uint64_t& off, FlatSeq& f)
+{
+    auto& seq = s->Packed();
+    f.NameOff = off;
+    f.NameLen = uint32_t(s->Name().size());
+    f.SeqOff = f.NameOff + f.NameLen;
+    f.SeqLen = seq.Len();
+    f.ExcOff = f.SeqOff + seq.Bytes().size();
+    f.NrExc = uint32_t(seq.Exceptions().size());
+    f.QualOff = f.ExcOff + f.NrExc * (sizeof(uint32_t) + 1);
+    f.QualLen = s->Quals().Len();
+    f.QualKind = s->Quals().Kind();
+    f.Score = s->Score();
+    f.ErrorRate = s->ErrorRate();
+    off = f.QualOff + s->Quals().Data().size();
+}
+
+static void writeSeqBytes(flatWriter& w, const SeqUptr& s)
+{
+    if (s == nullptr) {
+	return;
+    }
+    auto& seq = s->Packed();
+    w.Write(s->Name().data(), s->Name().size());
+    w.Write(seq.Bytes().data(), seq.Bytes().size());
+    for (auto& e : seq.Exceptions()) {
+	w.Put(e.Pos);
+    }
+    for (auto& e : seq.Exceptions()) {
+	w.Put(e.Base);
+    }
+    w.Write(s->Quals().Data().data(), s->Quals().Data().size());
+}
+
+BatchSummary SummarizeBatch(const Batch& b)
+{
+    BatchSummary s;
+    memset(&s, 0, sizeof(s));
+    auto& cls = b.Cls;
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	auto& r = cls.Rep(c);
+	if (r != nullptr && r->RawSeq != nullptr && r->RawSeq->Score() > -1) {
+	    s.NrClusters++;
+	    if (cls.NrMembers(c) > 1) {
+		s.NrNontrivialClusters++;
+	    }
+	}
+    }
+    s.NrMembers = cls.NrMembers();
+    s.MinDBSize = b.MinDB.Size();
+    return s;
+}
+
+void WriteBatchFile(const Batch& b, const std::string& outFile)
+{
+    auto summary = SummarizeBatch(b);
+    auto& cls = b.Cls;
+    uint64_t nrReps = 0;
+    uint64_t nrMins = 0;
+    uint64_t nrBytes = 0;
+    uint64_t nrPostings = 0;
+    // Forward and reverse minimizers of each representative, encoded.
+    std::vector<std::string> mins(2 * size_t(cls.Size()));
+    tbb::parallel_for(unsigned(0), cls.Size(), [&](unsigned c) {
+	auto& p = cls.Rep(c);
+	if (p != nullptr) {
+	    EncodeMinimizers(p->Mins, b.SortArgs.KmerSize, mins[2 * c]);
+	    EncodeMinimizers(p->RevMins, b.SortArgs.KmerSize, mins[2 * c + 1]);
+	}
+    });
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	if (cls.Rep(c) != nullptr) {
+	    nrReps++;
+	    nrMins += mins[2 * c].size() + mins[2 * c + 1].size();
+	}
+    }
+    b.MinDB.ForEach([&nrPostings](unsigned, const PostingList& p) {
+	nrPostings += p.size();
+    });
+
+    flatWriter w(outFile, b.SortArgs.BatchCompression);
+    std::string meta;
+    saveMeta(b, meta);
+    w.Begin(SecMeta, 1, false);
+    w.Write(meta.data(), meta.size());
+    w.End();
+
+    w.Begin(SecSummary, 1, false);
+    w.Put(summary);
+    w.End();
+
+    w.Begin(SecClsSizes, cls.Size());
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	w.Put(uint32_t(cls.Rep(c) == nullptr ? FLAT_NULL_CLUSTER
+					     : cls.NrMembers(c)));
+    }
+    w.End();
+
+    uint64_t minsOff = 0;
+    w.Begin(SecRecords, nrReps);
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	auto& p = cls.Rep(c);
+	if (p == nullptr) {
+	    continue;
+	}
+	FlatProcSeq f;
+	memset(&f, 0, sizeof(f));
+	f.MatchStrand = p->MatchStrand;
+	f.Id = p->Id;
+	if (p->RawSeq != nullptr) {
+	    f.Flags |= FLAT_HAS_RAW;
+	    flatSeq(p->RawSeq, nrBytes, f.Raw);
+	}
+	if (p->HpcSeq != nullptr) {
+	    f.Flags |= FLAT_HAS_HPC;
+	    flatSeq(p->HpcSeq, nrBytes, f.Hpc);
+	}
+	f.MinsOff = minsOff;
+	f.MinsLen = uint32_t(p->Mins.size());
+	f.RevMinsOff = f.MinsOff + mins[2 * c].size();
+	f.RevMinsLen = uint32_t(p->RevMins.size());
+	minsOff = f.RevMinsOff + mins[2 * c + 1].size();
+	w.Put(f);
+    }
+    w.End();
+
+    w.Begin(SecMins, nrMins);
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	if (cls.Rep(c) != nullptr) {
+	    w.Write(mins[2 * c].data(), mins[2 * c].size());
+	    w.Write(mins[2 * c + 1].data(), mins[2 * c + 1].size());
+	}
+    }
+    w.End();
+    mins.clear();
+
+    w.Begin(SecBytes, nrBytes);
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	auto& p = cls.Rep(c);
+	if (p != nullptr) {
+	    writeSeqBytes(w, p->RawSeq);
+	    writeSeqBytes(w, p->HpcSeq);
+	}
+    }
+    w.End();
+
+    // Members are written grouped by cluster.
+    auto order = cls.MemberOrder();
+    w.Begin(SecMembers, order.size());
+    for (auto m : order) {
+	w.Put(uint64_t(cls.MemberId(m)));
+    }
+    w.End();
+
+    w.Begin(SecStrands, order.size());
+    for (auto m : order) {
+	w.Put(int8_t(cls.MemberStrand(m)));
+    }
+    w.End();
+
+    w.Begin(SecKeys, b.MinDB.Size());
+    b.MinDB.ForEach(
+	[&w](unsigned key, const PostingList&) { w.Put(uint32_t(key)); });
+    w.End();
+
+    uint64_t postingOff = 0;
+    w.Begin(SecPostOffs, b.MinDB.Size() + 1);
+    w.Put(postingOff);
+    b.MinDB.ForEach([&](unsigned, const PostingList& p) {
+	postingOff += p.size();
+	w.Put(postingOff);
+    });
+    w.End();
+
+    w.Begin(SecPostings, nrPostings);
+    b.MinDB.ForEach([&w](unsigned, const PostingList& p) {
+	w.Write(p.data(), p.size() * sizeof(unsigned));
+    });
+    w.End();
+
+    std::ostringstream os;
+    {
+	cereal::BinaryOutputArchive archive(os);
+	archive(b.ConsGs);
+    }
+    auto consGs = os.str();
+    w.Begin(SecConsGs, b.ConsGs.size());
+    w.Write(consGs.data(), consGs.size());
+    w.End();
+
+    w.Finish();
+}
+
+BatchFile::BatchFile(const std::string& inFile) : file(inFile)
+{
+    BatchFileHeader h;
+    auto size = file.Size();
+    if (size >= sizeof(h)) {
+	memcpy(&h, file.Data(), sizeof(h));
+    }
+    if (size < sizeof(h) ||
+	memcmp(h.Magic, BATCH_FILE_MAGIC, sizeof(h.Magic)) != 0) {
+	std::cerr << "Invalid batch file: " << inFile << std::endl;
+	exit(1);
+    }
+    if (h.Version != BATCH_FILE_VERSION) {
+	std::cerr << "Unsupported batch file version " << h.Version << ": "
+		  << inFile << std::endl;
+	exit(1);
+    }
+    if (h.TableOffset + uint64_t(h.NrSections) * sizeof(BatchSection) !=
+	size) {
+	std::cerr << "Truncated batch file: " << inFile << std::endl;
+	exit(1);
+    }
+    sections.resize(h.NrSections);
+    memcpy(sections.data(), file.Data() + h.TableOffset,
+	   sections.size() * sizeof(BatchSection));
+    for (auto& s : sections) {
+	if (s.Offset + s.Size > h.TableOffset) {
+	    std::cerr << "Corrupt section table in batch file: " << inFile
+		      << std::endl;
+	    exit(1);
+	}
+    }
+}
+
+const BatchSection& BatchFile::find(uint32_t id) const
+{
+    for (auto& s : sections) {
+	if (s.Id == id) {
+	    return s;
+	}
+    }
+    std::cerr << "Missing section " << id << " in batch file: " << file.Path()
+	      << std::endl;
+    exit(1);
+    return sections.front();
+}
+
+// Section contents, inflated on first use if compressed.
+const char* BatchFile::data(const BatchSection& s) const
+{
+    if (s.Codec == CodecRaw) {
+	return file.Data() + s.Offset;
+    }
+    if (s.Codec != CodecZlib) {
+	std::cerr << "Unknown codec " << s.Codec << " in batch file: "
+		  << file.Path() << std::endl;
+	exit(1);
+    }
+    auto it = inflated.find(s.Id);
+    if (it != inflated.end()) {
+	return it->second.data();
+    }
+
+    uint64_t nrBlocks = (s.RawSize + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+    auto packed = file.Data() + s.Offset;
+    std::vector<uint64_t> blockOffs(nrBlocks + 1, 0);
+    bool ok = (s.Size >= nrBlocks * sizeof(uint32_t));
+    auto sizesOff = s.Size - nrBlocks * sizeof(uint32_t);
+    for (uint64_t i = 0; ok && i < nrBlocks; i++) {
+	uint32_t len;
+	memcpy(&len, packed + sizesOff + i * sizeof(uint32_t), sizeof(len));
+	blockOffs[i + 1] = blockOffs[i] + len;
+    }
+    ok = ok && (blockOffs[nrBlocks] == sizesOff);
+
+    std::string out(s.RawSize, 0);
+    std::atomic<bool> failed{!ok};
+    if (ok) {
+	tbb::parallel_for(uint64_t(0), nrBlocks, [&](uint64_t i) {
+	    auto start = i * BATCH_BLOCK_SIZE;
+	    uLongf len = uLongf(
+		std::min(uint64_t(BATCH_BLOCK_SIZE), s.RawSize - start));
+	    auto expected = len;
+	    auto ret = uncompress(
+		reinterpret_cast<Bytef*>(&out[start]), &len,
+		reinterpret_cast<const Bytef*>(packed + blockOffs[i]),
+		uLong(blockOffs[i + 1] - blockOffs[i]));
+	    if (ret != Z_OK || len != expected) {
+		failed = true;
+	    }
+	});
+    }
+    if (failed) {
+	std::cerr << "Corrupt compressed section " << s.Id
+		  << " in batch file: " << file.Path() << std::endl;
+	exit(1);
+    }
+    return (inflated[s.Id] = std::move(out)).data();
+}
+
+// Locate an array section, checking its size against the element count.
+const char* BatchFile::section(uint32_t id, size_t elemSize,
+			       uint64_t& count) const
+{
+    auto& s = find(id);
+    if (s.RawSize != s.Count * elemSize) {
+	std::cerr << "Corrupt section " << id
+		  << " in batch file: " << file.Path() << std::endl;
+	exit(1);
+    }
+    count = s.Count;
+    return data(s);
+}
+
+double BatchFile::CompressionRatio() const
+{
+    uint64_t raw = 0, stored = 0;
+    for (auto& s : sections) {
+	raw += s.RawSize;
+	stored += s.Size;
+    }
+    return (stored == 0 ? 1.0 : double(raw) / double(stored));
+}
+
+BatchSummary BatchFile::Summary() const
+{
+    uint64_t n;
+    BatchSummary s;
+    memcpy(&s, section(SecSummary, sizeof(s), n), sizeof(s));
+    return s;
+}
+
+void BatchFile::LoadMeta(Batch& b) const
+{
+    auto& s = find(SecMeta);
+    memBuf buf(data(s), s.RawSize);
+    std::istream is(&buf);
+    cereal::BinaryInputArchive archive(is);
+    archive(b.BatchNr, b.BatchStart, b.BatchEnd, b.BatchBases, b.TotalReads,
+	    b.NrCls, b.SortArgs, b.LeftLeaf, b.RightLeaf, b.Depth);
+}
+
+static SeqUptr loadSeq(const char* bytes, const FlatSeq& f)
+{
+    PackedSeq seq(f.SeqLen, reinterpret_cast<const uint8_t*>(bytes + f.SeqOff),
+		  bytes + f.ExcOff,
+		  bytes + f.ExcOff + size_t(f.NrExc) * sizeof(uint32_t),
+		  f.NrExc);
+    auto kind = QualKind(f.QualKind);
+    QualStore qual(kind, f.QualLen,
+		   std::string(bytes + f.QualOff,
+			       QualStore::DataSize(kind, f.QualLen)));
+    auto s = SeqUptr(
+	new Seq(std::string(bytes + f.NameOff, f.NameLen), std::move(seq),
+		std::move(qual), f.Score));
+    s->SetErrorRate(f.ErrorRate);
+    return s;
+}
+
+void BatchFile::LoadClusters(Batch& b) const
+{
+    uint64_t nrCls, nrRecords, nrMins, nrBytes, nrMembers, nrStrands;
+    auto sizes = reinterpret_cast<const uint32_t*>(
+	section(SecClsSizes, sizeof(uint32_t), nrCls));
+    auto records = reinterpret_cast<const FlatProcSeq*>(
+	section(SecRecords, sizeof(FlatProcSeq), nrRecords));
+    auto mins = section(SecMins, 1, nrMins);
+    auto bytes = section(SecBytes, 1, nrBytes);
+    auto members = reinterpret_cast<const uint64_t*>(
+	section(SecMembers, sizeof(uint64_t), nrMembers));
+    auto strands = reinterpret_cast<const int8_t*>(
+	section(SecStrands, sizeof(int8_t), nrStrands));
+
+    // Record of each cluster, clusters without representative have none.
+    std::vector<uint64_t> record(nrCls + 1, 0);
+    std::vector<unsigned> counts(nrCls, 0);
+    for (uint64_t i = 0; i < nrCls; i++) {
+	auto null = (sizes[i] == FLAT_NULL_CLUSTER);
+	record[i + 1] = record[i] + (null ? 0 : 1);
+	counts[i] = (null ? 0 : sizes[i]);
+    }
+    if (record[nrCls] != nrRecords || nrStrands != nrMembers) {
+	std::cerr << "Corrupt batch file: " << file.Path() << std::endl;
+	exit(1);
+    }
+
+    auto& cls = b.Cls;
+    cls.Clear();
+    cls.Resize(unsigned(nrCls));
+    cls.AssignMembers(counts, members, strands, nrMembers);
+    tbb::parallel_for(uint64_t(0), nrCls, [&](uint64_t i) {
+	if (sizes[i] == FLAT_NULL_CLUSTER) {
+	    return;
+	}
+	auto& f = records[record[i]];
+	auto p = std::make_shared<ProcSeq>();
+	p->MatchStrand = f.MatchStrand;
+	p->Id = f.Id;
+	if (f.Flags & FLAT_HAS_RAW) {
+	    p->RawSeq = loadSeq(bytes, f.Raw);
+	}
+	if (f.Flags & FLAT_HAS_HPC) {
+	    p->HpcSeq = loadSeq(bytes, f.Hpc);
+	}
+	auto minsEnd = mins + nrMins;
+	if (f.MinsOff > nrMins || f.RevMinsOff > nrMins ||
+	    DecodeMinimizers(mins + f.MinsOff, minsEnd, f.MinsLen, p->Mins) ==
+		nullptr ||
+	    DecodeMinimizers(mins + f.RevMinsOff, minsEnd, f.RevMinsLen,
+			     p->RevMins) == nullptr) {
+	    std::cerr << "Corrupt minimizers in batch file: " << file.Path()
+		      << std::endl;
+	    exit(1);
+	}
+	cls.Rep(unsigned(i)) = std::move(p);
+    });
+    inflated.clear();
+}
+
+void BatchFile::LoadMinDB(Batch& b) const
+{
+    uint64_t nrKeys, nrOffs, nrPostings;
+    auto keys = reinterpret_cast<const uint32_t*>(
+	section(SecKeys, sizeof(uint32_t), nrKeys));
+    auto postOffs = reinterpret_cast<const uint64_t*>(
+	section(SecPostOffs, sizeof(uint64_t), nrOffs));
+    auto postings = reinterpret_cast<const unsigned*>(
+	section(SecPostings, sizeof(unsigned), nrPostings));
+    if (nrOffs != nrKeys + 1 || postOffs[nrKeys] != nrPostings) {
+	std::cerr << "Corrupt minimizer database in batch file: "
+		  << file.Path() << std::endl;
+	exit(1);
+    }
+    b.MinDB.Reserve(nrKeys);
+    for (uint64_t i = 0; i < nrKeys; i++) {
+	b.MinDB.Assign(keys[i], postings + postOffs[i],
+		       postOffs[i + 1] - postOffs[i]);
+    }
+    inflated.clear();
+}
+
+void BatchFile::LoadConsGs(Batch& b) const
+{
+    auto& s = find(SecConsGs);
+    memBuf buf(data(s), s.RawSize);
+    std::istream is(&buf);
+    cereal::BinaryInputArchive archive(is);
+    archive(b.ConsGs);
+    inflated.clear();
+}
+
+BatchP ReadBatchFile(const std::string& inFile, unsigned parts)
+{
+    BatchFile file(inFile);
+    auto b = BatchP(new Batch);
+    file.LoadMeta(*b);
+    if (parts & BATCH_LOAD_CLUSTERS) {
+	file.LoadClusters(*b);
+    }
+    if (parts & BATCH_LOAD_MINDB) {
+	file.LoadMinDB(*b);
+    }
+    if (parts & BATCH_LOAD_CONSGS) {
+	file.LoadConsGs(*b);
+    }
+    return b;
+}
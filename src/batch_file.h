@@ -0,0 +1,134 @@
+#ifndef BATCH_FILE_H_INCLUDED
+#define BATCH_FILE_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+#include "serialize.h"
+
+#define BATCH_FILE_MAGIC "ISCB"
+#define BATCH_FILE_VERSION 11
+#define BATCH_BLOCK_SIZE (1024 * 1024)
+
+/// Sectioned batch file: a header, the sections and a section table at
+/// the end. Each section starts at a multiple of 8 bytes and can be loaded
+/// on its own. The metadata and the consensus graphs are cereal blobs, the
+/// other sections are arrays used straight from a memory mapping.
+/// Clusters are stored as their member counts, a record per representative
+/// and the read ordinals and strands of the members grouped by cluster.
+/// Minimizer arrays use the EncodeMinimizers format, the records hold their
+/// byte offsets.
+///
+/// With SortArgs.BatchCompression set, sections other than the metadata
+/// and the summary are stored as zlib compressed blocks of
+/// BATCH_BLOCK_SIZE bytes, followed by the uint32 sizes of the blocks.
+typedef struct {
+    char Magic[4];
+    uint32_t Version;
+    uint32_t NrSections;
+    uint32_t Pad;
+    uint64_t TableOffset;
+} BatchFileHeader;
+
+typedef enum {
+    SecMeta = 1,
+    SecSummary,
+    SecClsSizes,
+    SecRecords,
+    SecMins,
+    SecBytes,
+    SecKeys,
+    SecPostOffs,
+    SecPostings,
+    SecConsGs,
+    SecMembers,
+    SecStrands
+} BatchSectionId;
+
+typedef enum { CodecRaw = 0, CodecZlib } BatchCodec;
+
+typedef struct {
+    uint32_t Id;
+    uint32_t Codec;
+    uint64_t Offset;
+    uint64_t Size;
+    uint64_t RawSize;
+    uint64_t Count;
+} BatchSection;
+
+/// Counters shown by info, so that it only needs the header.
+typedef struct {
+    uint64_t NrClusters;
+    uint64_t NrNontrivialClusters;
+    uint64_t MinDBSize;
+    uint64_t NrMembers;
+} BatchSummary;
+
+/// Location of a Seq in the sequence bytes: the name, the packed bases,
+/// the uint32 exception positions followed by their bases, the quality
+/// data of the given QualKind for QualLen bases.
+typedef struct {
+    uint64_t NameOff;
+    uint64_t SeqOff;
+    uint64_t ExcOff;
+    uint64_t QualOff;
+    uint32_t NameLen;
+    uint32_t SeqLen;
+    uint32_t NrExc;
+    uint32_t QualLen;
+    uint32_t QualKind;
+    uint32_t Pad;
+    double Score;
+    double ErrorRate;
+} FlatSeq;
+
+/// A ProcSeq with its sequences and minimizers as array slices.
+typedef struct {
+    FlatSeq Raw;
+    FlatSeq Hpc;
+    uint64_t Id;
+    uint64_t MinsOff;
+    uint64_t RevMinsOff;
+    uint32_t MinsLen;
+    uint32_t RevMinsLen;
+    int32_t MatchStrand;
+    uint32_t Flags;
+} FlatProcSeq;
+
+#define FLAT_HAS_RAW 1
+#define FLAT_HAS_HPC 2
+#define FLAT_NULL_CLUSTER 0xffffffffu
+
+/// Mapped batch file with access to single sections.
+class BatchFile {
+public:
+    explicit BatchFile(const std::string& inFile);
+
+    BatchSummary Summary() const;
+    void LoadMeta(Batch& b) const;
+    void LoadClusters(Batch& b) const;
+    void LoadMinDB(Batch& b) const;
+    void LoadConsGs(Batch& b) const;
+    const std::vector<BatchSection>& Sections() const { return sections; }
+    uint64_t FileSize() const { return file.Size(); }
+    /// Uncompressed over stored size of the sections.
+    double CompressionRatio() const;
+
+private:
+    const BatchSection& find(uint32_t id) const;
+    const char* data(const BatchSection& s) const;
+    const char* section(uint32_t id, size_t elemSize, uint64_t& count) const;
+
+    MappedFile file;
+    std::vector<BatchSection> sections;
+    mutable std::unordered_map<uint32_t, std::string> inflated;
+};
+
+BatchSummary SummarizeBatch(const Batch& b);
+void WriteBatchFile(const Batch& b, const std::string& outFile);
+BatchP ReadBatchFile(const std::string& inFile, unsigned parts);
+
+#endif
@@ -20,17 +20,16 @@
 using namespace std;
 unsigned ALN_INVOKED{0};
 unsigned CONS_INVOKED{0};
-UnsignedHash uh;
 extern std::unique_ptr<spoa::AlignmentEngine> SpoaEngine;
 
 int ProcSeqWeight(ProcSeq& s) { return int(s.RawSeq->MeanQual()); }
 
-void printSortedSizes(Clusters& cls)
+void printSortedSizes(const ClusterStore& cls)
 {
     std::vector<unsigned> sizes;
-    sizes.reserve(cls.size());
-    for (auto c : cls) {
-	auto s = c->size();
+    sizes.reserve(cls.Size());
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	auto s = cls.NrMembers(c) + 1;
 	if (s > 1) {
 	    sizes.push_back(s);
 	}
@@ -44,11 +43,11 @@ void printSortedSizes(Clusters& cls)
     }
 }
 
-unsigned countNtClusters(Clusters& cls)
+unsigned countNtClusters(const ClusterStore& cls)
 {
     unsigned count = 0;
-    for (auto& c : cls) {
-	if (c->size() > 1) {
+    for (unsigned c = 0; c < cls.Size(); c++) {
+	if (cls.NrMembers(c) > 0) {
 	    count++;
 	}
     }
@@ -60,12 +59,11 @@ void dumpMinimizers(const Minimizers& mins, const std::string& readId,
 {
     for (auto& m : mins) {
 	std::cerr << readId << "\t" << IndexToKmer(m.Min, kmerSize) << "\t"
-		  << m.Pos << "\t" << m.Index << std::endl;
+		  << m.Pos << "\t" << MinIndex(m) << std::endl;
     }
 }
 
-void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
-			bool seqPurge)
+void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet)
 {
     if (leftBatch->SortArgs != rightBatch->SortArgs) {
 	std::cerr << "The left and right batches have been sorted with "
@@ -89,19 +87,24 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 	exit(1);
     }
 
-    if (leftBatch->MinDB.size() == 0) {
-	leftBatch->MinDB = MinimizerDB(MIN_DB_RESERVE, uh);
+    if (leftBatch->MinDB.Empty()) {
+	leftBatch->MinDB = MinimizerDB(MIN_DB_RESERVE);
     }
 
-    rightBatch->MinDB = MinimizerDB(0, uh);
+    rightBatch->MinDB = MinimizerDB();
 
     auto& cls = leftBatch->Cls;
-    leftBatch->ConsGs.reserve(cls.size());
     auto& reads = rightBatch->Cls;
+    reads.Group();
+    cls.Reserve(cls.Size() + reads.Size(),
+		cls.NrMembers() + reads.NrMembers() + reads.Size());
+    leftBatch->ConsGs.reserve(cls.Size() + reads.Size());
     auto& minDB = leftBatch->MinDB;
+    PostingCounts postingCounts(minDB);
     auto& consMaxSize = leftBatch->SortArgs.ConsMaxSize;
 
-    auto sharedMinTab = InitMinSharedMap(args.KmerSize, args.WindowSize);
+    auto sharedMinTab =
+	InitMinSharedMap(args.KmerSize, args.WindowSize, args.HashMins);
 
     if (args.Debug) {
 	std::cerr
@@ -111,18 +114,22 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 
     unsigned sizeFiltered = 0;
     auto minClsSize = leftBatch->SortArgs.MinClsSize;
+    // Scratch space for the hits and k-mers of one read.
+    Arena queryArena;
 
-    for (unsigned i = 0; i < reads.size(); i++) {
-	if ((reads[i] == nullptr) || (reads[i]->size() == 0)) {
+    for (unsigned i = 0; i < reads.Size(); i++) {
+	auto& read = reads.Rep(i);
+	if (read == nullptr) {
 	    continue;
 	}
+	// Clusters of sorted batches are single reads without members.
+	auto nrMembers = reads.NrMembers(i);
 	if ((rightBatch->Depth > 0) && (minClsSize > 1) &&
-	    (int(reads[i]->size() - 1) < minClsSize)) {
+	    (int(nrMembers) < minClsSize)) {
 	    sizeFiltered++;
 	    continue;
 	}
-	auto& read = reads[i]->at(REP);
-	if (read == nullptr || read->RawSeq == nullptr) {
+	if (read->RawSeq == nullptr) {
 	    continue;
 	}
 	auto& seq = read->RawSeq;
@@ -131,8 +138,8 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 	if (args.Debug) {
 	    std::cerr << i << "\t";
 	    std::cerr << countNtClusters(cls) << "\t";
-	    std::cerr << minDB.size() << "\t";
-	    std::cerr << seq->Name() << "\t";
+	    std::cerr << minDB.Size() << "\t";
+	    std::cerr << read->Id << "\t";
 	    printSortedSizes(cls);
 	    std::cerr << std::endl;
 	}
@@ -140,16 +147,16 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 	int best = -2;
 
 	if (VERBOSE && !quiet) {
-	    Pbar((float)(i + 1) / float(reads.size()));
+	    Pbar((float)(i + 1) / float(reads.Size()));
 	}
 	if (seq->Score() < 0) {
 	    continue;
 	}
-	if (seq->Str().length() < unsigned(2 * args.KmerSize)) {
+	if (seq->Len() < unsigned(2 * args.KmerSize)) {
 	    seq->SetScore(-1.0);
 	    continue;
 	}
-	if (hpcSeq->Str().length() < unsigned(2 * args.KmerSize)) {
+	if (hpcSeq->Len() < unsigned(2 * args.KmerSize)) {
 	    seq->SetScore(-1.0);
 	    continue;
 	}
@@ -162,25 +169,24 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 	const auto& mins = read->Mins;
 	const auto& revMins = read->RevMins;
 	StrandedCluster stMatch;
+	queryArena.Reset();
 	if (best != -1) {
-	    stMatch = getBestCluster(i, leftBatch, rightBatch, sharedMinTab);
+	    stMatch =
+		getBestCluster(i, leftBatch, rightBatch, sharedMinTab,
+			       &queryArena, postingCounts.Cutoff(args.MaskMins));
 	    best = stMatch.first;
 	}
 
-	auto startIt = reads[i]->begin();
-	auto readTmp = *startIt;
-
-	auto readSeq = std::string(readTmp->RawSeq->Str());
-	auto readRawErr = readTmp->RawSeq->ErrorRate();
-	auto readHpcErr = readTmp->HpcSeq->ErrorRate();
+	auto readSeq = seq->Str();
+	auto readRawErr = seq->ErrorRate();
+	auto readHpcErr = hpcSeq->ErrorRate();
 
 	if (best == -1) {
-	    auto newId = unsigned(cls.size());
-	    auto nrReads = reads[i]->size();
-	    AddMinimizers(mins, newId, minDB);
-	    if (nrReads == 1) {
+	    auto newId = cls.Size();
+	    AddMinimizers(mins, newId, minDB, &postingCounts);
+	    if (nrMembers == 0) {
 		auto nrep = new ProcSeq;
-		auto rep = reads[i]->at(0);
+		auto& rep = read;
 		nrep->RawSeq = std::unique_ptr<Seq>(new Seq);
 		*(nrep->RawSeq) = *(rep->RawSeq);
 		nrep->HpcSeq = std::unique_ptr<Seq>(new Seq);
@@ -193,27 +199,20 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 			       "_" + std::to_string(newId);
 		nrep->RawSeq->SetName(repName);
 		nrep->HpcSeq->SetName(repName);
-		reads[i]->insert(reads[i]->begin(), 1,
-				 std::unique_ptr<ProcSeq>(nrep));
+		cls.Add(ProcSeqP(nrep));
+		cls.AddMember(newId, rep->Id, rep->MatchStrand);
+	    }
+	    else {
+		cls.Add(read);
+		cls.AddMembers(newId, reads, i, false);
 	    }
 
 		auto leftGraph = std::unique_ptr<spoa::Graph>(new spoa::Graph);
 	    leftBatch->ConsGs.push_back(std::move(leftGraph));
 
-	    AddSeqToGraph(reads[i]->at(0)->RawSeq->Str(),
+	    AddSeqToGraph(cls.Rep(newId)->RawSeq->Str(),
 			  leftBatch->ConsGs[newId].get(), SpoaEngine.get(), 1);
 
-	    cls.emplace_back(reads[i]);
-	    if (nrReads == 1 && cls[newId]->size() != 2) {
-		std::cerr << "Inconsistent initial cluster size "
-			  << cls[newId]->size()
-			  << " for "
-			     "read: "
-			  << cls[newId]->at(0)->RawSeq->Name() << std::endl;
-		std::cerr << "Aborting clustering!" << std::endl;
-		exit(1);
-	    }
-
 	    leftBatch->NrCls++;
 	    if (rightBatch->ConsGs.size() > 0 &&
 		rightBatch->ConsGs[i] != nullptr) {
@@ -221,44 +220,19 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 	    }
 	}
 	else {
-	    cls[best]->reserve(cls[best]->size() + reads[i]->size());
-	    // Free unecessary minimizers:
-	    auto tmp = Minimizers(0);
-	    for (unsigned j = 0; j < reads[i]->size(); j++) {
-		auto& s = reads[i]->at(j);
-		if (s == nullptr) {
-		    std::cerr << "Null pointer at position " << j
-			      << " in read array " << i
-			      << " of size: " << reads[i]->size() << std::endl;
-		    exit(1);
-		}
-		if (stMatch.second == -1) {
-		    switch (s->MatchStrand) {
-			case 1:
-			    s->MatchStrand = -1;
-			    break;
-			case -1:
-			    s->MatchStrand = 1;
-			    break;
-			default:
-			    throw("Invalid match strand!");
-		    }
-		}
-		s->Mins = tmp;
-		s->RevMins = tmp;
-		if (!seqPurge) {
-		    s->RawSeq = nullptr;
-		    s->HpcSeq = nullptr;
+	    auto flip = (stMatch.second == -1);
+	    if (nrMembers == 0) {
+		auto strand = read->MatchStrand;
+		if (flip && strand != 1 && strand != -1) {
+		    throw("Invalid match strand!");
 		}
+		cls.AddMember(best, read->Id, flip ? -strand : strand);
 	    }
-
-	    if (reads[i]->size() > 1) {
-		startIt++;
+	    else {
+		cls.AddMembers(best, reads, i, flip);
 	    }
-
-	    auto oldSize = reads[i]->size();
-	    std::move(startIt, std::end(*(reads[i])),
-		      std::back_inserter(*(cls[best])));
+	    // Only the representatives keep sequences and minimizers.
+	    read = nullptr;
 
 	    if (consMaxSize <= 0) {
 		continue;
@@ -266,7 +240,8 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 
 	    if ((leftBatch->Depth == -1) &&
 		(leftBatch->SortArgs.ConsPeriod > 0) &&
-		(int(cls[best]->size()) > leftBatch->SortArgs.ConsPeriod)) {
+		(int(cls.NrMembers(best) + 1) >
+		 leftBatch->SortArgs.ConsPeriod)) {
 		continue;
 	    }
 
@@ -281,24 +256,26 @@ void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
 				   std::to_string(leftBatch->BatchNr) + "_" +
 				   std::to_string(i);
 
-	    auto oldMins = cls.at(best)->at(REP)->Mins;
+	    auto& bestRep = *cls.Rep(best);
+	    auto oldMins = bestRep.Mins;
 	    auto consMinSize = leftBatch->SortArgs.ConsMinSize;
 	    if (leftBatch->Depth != -1) {
 		consMinSize = 2;  // FIXME
 	    }
 	    auto ok = UpdateClusterConsensus(
-		consName, *(cls[best]), consGraphLeft, consGraphRight, readSeq,
+		consName, bestRep, consGraphLeft, consGraphRight, readSeq,
 		readRawErr, readHpcErr, stMatch.second, consMinSize,
-		consMaxSize, args.KmerSize, args.WindowSize);
+		consMaxSize, args.KmerSize, args.WindowSize,
+		args.CanonicalMins, args.HashMins, &queryArena);
 
 	    if (ok) {
 		CONS_INVOKED++;
-		UpdateMinDB(best, oldMins, cls[best]->at(REP)->Mins, minDB);
+		UpdateMinDB(best, oldMins, bestRep.Mins, minDB, &postingCounts);
 	    }
 
 	    if (ok && (int(consGraphLeft->sequences().size()) > consMaxSize)) {
 		auto newGraph =
-		    ConsPurge(consGraphLeft, SpoaEngine.get(), *(cls[best]));
+		    ConsPurge(consGraphLeft, SpoaEngine.get(), bestRep);
 		leftBatch->ConsGs[best].swap(newGraph);
 	    }
 
@@ -345,10 +322,10 @@ double getMappedRatio(const Seq& hpcSeq, const Seq& clHpcSeq,
 
     auto& h = hits[hits.size() - 1];
     if (pow(pError, double(mins.size() - (h.Index + 1))) >= minProbNoHits) {
-	totalMapped += hpcSeq.Str().length() - h.Pos;
+	totalMapped += hpcSeq.Len() - h.Pos;
     }
 
-    auto mr = totalMapped / (double)hpcSeq.Str().length();
+    auto mr = totalMapped / (double)hpcSeq.Len();
     return mr;
 }
 
@@ -381,22 +358,15 @@ StrandedCluster getBestClusterMapping(const ProcSeq& read,
     for (auto& c : order) {
 	auto& nmHits = c->Size;
 	auto& clId = c->Cls;
-	const Minimizers& m = mins;
 	auto strand = c->Strand;
 	auto scl = std::make_pair(int(clId), int(strand));
 	if (int(nmHits) < int((double)nrTopHits * minFrac)) {
 	    return NEG;
 	}
-	float mr = 0.0;
-	if (strand == 1) {
-	    mr = getMappedRatio(*hpcSeq, *(cls.at(clId)->at(REP)->HpcSeq), mins,
-				hits.at(scl), sharedMinTab, minProbNoHits);
-	}
-	else {
-	    mr = getMappedRatio(*hpcSeq, *(cls.at(clId)->at(REP)->HpcSeq),
-				revMins, hits.at(scl), sharedMinTab,
-				minProbNoHits);
-	}
+	// Canonical minimizers hit both strands from the forward array.
+	const Minimizers& m = (strand == 1 || revMins.empty()) ? mins : revMins;
+	float mr = getMappedRatio(*hpcSeq, *(cls.Rep(clId)->HpcSeq), m,
+				  hits.at(scl), sharedMinTab, minProbNoHits);
 	if (mr >= mappedTh) {
 	    return scl;
 	}
@@ -470,7 +440,7 @@ StrandedCluster getBestClusterAln(const ProcSeq& read,
 	return NEG;
     }
     auto topHit = hitOrder[0]->Size;
-    auto& readSeq = read.RawSeq->Str();
+    auto readSeq = read.RawSeq->Str();
 
     int match = 2;
     int mismatch = -2;
@@ -484,13 +454,12 @@ StrandedCluster getBestClusterAln(const ProcSeq& read,
 	}
 	auto strand = c->Strand;
 	auto clId = unsigned(c->Cls);
-	auto& rep = clsLeft[clId]->at(REP)->RawSeq;
-	auto repSeq = std::string(rep->Str());
+	auto& rep = clsLeft.Rep(clId)->RawSeq;
+	auto repSeq = rep->Str();
 	if (strand == -1) {
-	    repSeq = RevComp(repSeq);
+	    RevCompInPlace(repSeq);
 	}
 	auto e2 = rep->ErrorRate();
-	auto& clsQual = rep->Qual();
 
 	auto e1 = read.RawSeq->ErrorRate();
 	int gapOpen = setGapOpen(e1 + e2);
@@ -515,12 +484,12 @@ StrandedCluster getBestClusterAln(const ProcSeq& read,
 }
 
 void dumpSortedHits(const SortedHits& order, const std::string& readId,
-		    const Clusters& cls)
+		    const ClusterStore& cls)
 {
     unsigned i = 0;
     std::cerr << readId << std::endl;
     for (auto& h : order) {
-	std::cerr << "\t" << i << "\t" << cls[h->Cls]->at(REP)->RawSeq->Name()
+	std::cerr << "\t" << i << "\t" << cls.Rep(h->Cls)->Id
 		  << "\t" << h->Size << "\t" << h->Cls << "\t" << h->Strand
 		  << std::endl;
 	i++;
@@ -529,13 +498,16 @@ void dumpSortedHits(const SortedHits& order, const std::string& readId,
 
 StrandedCluster getBestCluster(const unsigned rightId, BatchP& leftBatch,
 			       BatchP& rightBatch,
-			       const MinSharedMap& sharedMinTab)
+			       const MinSharedMap& sharedMinTab, Arena* arena,
+			       unsigned maxPostings)
 {
     auto mode = leftBatch->SortArgs.Mode;
     auto minShared = leftBatch->SortArgs.MinShared;
     auto minProbNoHits = leftBatch->SortArgs.MinProbNoHits;
-    auto& read = rightBatch->Cls[rightId]->at(REP);
-    auto&& hits = GetMinimizerHits(read->Mins, read->RevMins, leftBatch->MinDB);
+    auto& read = rightBatch->Cls.Rep(rightId);
+    auto&& hits =
+	GetMinimizerHits(read->Mins, read->RevMins, leftBatch->MinDB, arena,
+			 maxPostings);
     auto&& hitOrder = SortMinimizerHits(hits, leftBatch->Cls);
     auto NEG = std::make_pair(-1, 0);
     if (hitOrder.size() == 0) {
@@ -567,16 +539,17 @@ StrandedCluster getBestCluster(const unsigned rightId, BatchP& leftBatch,
     return NEG;
 }
 
-void SortClustersBySize(Clusters& cls)
+void SortClustersBySize(ClusterStore& cls)
 {
-    std::sort(cls.begin(), cls.end(),
-	      [](const shared_ptr<Cluster> a, const shared_ptr<Cluster> b) {
-		  if (a->size() == b->size()) {
-		      return a->at(REP)->RawSeq->Score() >
-			     b->at(REP)->RawSeq->Score();
-		  }
-		  return a->size() > b->size();
-	      });
+    std::vector<unsigned> order(cls.Size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&cls](unsigned a, unsigned b) {
+	if (cls.NrMembers(a) == cls.NrMembers(b)) {
+	    return cls.Rep(a)->RawSeq->Score() > cls.Rep(b)->RawSeq->Score();
+	}
+	return cls.NrMembers(a) > cls.NrMembers(b);
+    });
+    cls.Permute(order);
 }
 
 unsigned AlnInvoked() { return ALN_INVOKED; }
@@ -610,7 +583,14 @@ void ConsolidateMinimizerHits(const RawMinimizerHits& hits, MinimizerHits& res,
 			      int strand)
 {
     for (auto& mp : hits) {
-	res[std::make_pair(mp.Cls, strand)].emplace_back(std::move(mp.Hits));
+	auto key = std::make_pair(int(mp.Cls), strand);
+	auto it = res.find(key);
+	if (it == res.end()) {
+	    // Hit vectors share the arena of the map.
+	    it = res.emplace(key, MinimizerHitVector(res.get_allocator()))
+		     .first;
+	}
+	it->second.emplace_back(mp.Hits);
     }
 }
 
@@ -619,7 +599,8 @@ bool hitsSortUtil(const SortedHitP& a, const SortedHitP& b)
     return a->Size > b->Size;
 }
 
-SortedHits SortMinimizerHits(const MinimizerHits& hits, const Clusters& cls)
+SortedHits SortMinimizerHits(const MinimizerHits& hits,
+			     const ClusterStore& cls)
 {
     SortedHits sorted;
     sorted.reserve(hits.size());
@@ -10,14 +10,12 @@
 #include "parasail.h"
 #include "serialize.h"
 
-#define REP 0
-
-void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet,
-			bool seqPurge);
+void ClusterSortedReads(BatchP& leftBatch, BatchP& rightBatch, bool quiet);
 
 StrandedCluster getBestCluster(const unsigned rightId, BatchP& leftBatch,
 			       BatchP& rightBatch,
-			       const MinSharedMap& sharedMinTab);
+			       const MinSharedMap& sharedMinTab,
+			       Arena* arena = nullptr, unsigned maxPostings = 0);
 
 double getMappedRatio(const Seq& hpcSeq, const Seq& clHpcSeq,
 		      const Minimizers& mins, const MinimizerHitVector& hits,
@@ -29,13 +27,14 @@ parasail_result_t* ParasailAlign(const std::string& ref,
 				 const parasail_matrix_t* user_matrix);
 double getAlnRatio(const std::string& comp, double e, unsigned slen,
 		   unsigned kmerSize);
-void SortClustersBySize(Clusters& cls);
+void SortClustersBySize(ClusterStore& cls);
 unsigned AlnInvoked();
 double AlnInvokedPerc(int total);
 unsigned ConsInvoked();
 double ConsInvokedPerc(int total);
 int ProcSeqWeight(ProcSeq& s);
-SortedHits SortMinimizerHits(const MinimizerHits& hits, const Clusters& cls);
+SortedHits SortMinimizerHits(const MinimizerHits& hits,
+			     const ClusterStore& cls);
 
 #endif
 
@@ -17,7 +17,8 @@ typedef struct {
     Minimizers Mins;
     Minimizers RevMins;
     int MatchStrand;
-    std::string Id;
+    /// Ordinal of the read in the sorted read store.
+    unsigned long long Id;
     template <class Archive>
     void serialize(Archive& archive)
     {
@@ -25,8 +26,7 @@ typedef struct {
     };
 } ProcSeq;
 
-typedef std::vector<shared_ptr<ProcSeq>> Cluster;
-typedef std::vector<shared_ptr<Cluster>> Clusters;
+typedef std::shared_ptr<ProcSeq> ProcSeqP;
 
 #endif
 
@@ -0,0 +1,167 @@
+#include "cluster_store.h"
+
+#include <algorithm>
+#include <iostream>
+
+void ClusterStore::Clear()
+{
+    reps.clear();
+    sizes.clear();
+    ids.clear();
+    strands.clear();
+    owners.clear();
+    offsets.assign(1, 0);
+    grouped = true;
+}
+
+void ClusterStore::Reserve(size_t nrCls, size_t nrMembers)
+{
+    reps.reserve(nrCls);
+    sizes.reserve(nrCls);
+    offsets.reserve(nrCls + 1);
+    ids.reserve(nrMembers);
+    strands.reserve(nrMembers);
+    owners.reserve(nrMembers);
+}
+
+void ClusterStore::Resize(unsigned nrCls)
+{
+    reps.resize(reps.size() + nrCls);
+    sizes.resize(reps.size(), 0);
+    if (grouped) {
+	offsets.resize(reps.size() + 1, ids.size());
+    }
+}
+
+unsigned ClusterStore::Add(const ProcSeqP& rep)
+{
+    reps.push_back(rep);
+    sizes.push_back(0);
+    if (grouped) {
+	offsets.push_back(ids.size());
+    }
+    return unsigned(reps.size() - 1);
+}
+
+void ClusterStore::AddMember(unsigned c, unsigned long long id, int strand)
+{
+    if (c >= reps.size()) {
+	std::cerr << "Member added to missing cluster " << c << "!"
+		  << std::endl;
+	exit(1);
+    }
+    // Appending to the last cluster keeps the members grouped.
+    if (grouped && c + 1 != reps.size()) {
+	grouped = false;
+    }
+    ids.push_back(id);
+    strands.push_back(int8_t(strand));
+    owners.push_back(c);
+    sizes[c]++;
+    if (grouped) {
+	offsets.back() = ids.size();
+    }
+}
+
+void ClusterStore::AddMembers(unsigned c, const ClusterStore& other,
+			      unsigned oc, bool flip)
+{
+    if (!other.grouped) {
+	std::cerr << "Members copied from an ungrouped cluster store!"
+		  << std::endl;
+	exit(1);
+    }
+    for (auto m = other.offsets[oc]; m < other.offsets[oc + 1]; m++) {
+	AddMember(c, other.ids[m], flip ? -other.strands[m] : other.strands[m]);
+    }
+}
+
+void ClusterStore::AssignMembers(const std::vector<unsigned>& counts,
+				 const uint64_t* memberIds,
+				 const int8_t* memberStrands,
+				 unsigned long long nrMembers)
+{
+    if (counts.size() != reps.size()) {
+	std::cerr << "Member counts do not match the clusters!" << std::endl;
+	exit(1);
+    }
+    sizes = counts;
+    ids.assign(memberIds, memberIds + nrMembers);
+    strands.assign(memberStrands, memberStrands + nrMembers);
+    owners.resize(nrMembers);
+    offsets.assign(reps.size() + 1, 0);
+    for (unsigned c = 0; c < reps.size(); c++) {
+	offsets[c + 1] = offsets[c] + sizes[c];
+	if (offsets[c + 1] > nrMembers) {
+	    break;
+	}
+	std::fill(owners.begin() + offsets[c], owners.begin() + offsets[c + 1],
+		  c);
+    }
+    if (offsets.back() != nrMembers) {
+	std::cerr << "Cluster sizes do not match the number of members!"
+		  << std::endl;
+	exit(1);
+    }
+    grouped = true;
+}
+
+std::vector<unsigned long long> ClusterStore::MemberOrder() const
+{
+    std::vector<unsigned long long> start(reps.size() + 1, 0);
+    for (unsigned c = 0; c < reps.size(); c++) {
+	start[c + 1] = start[c] + sizes[c];
+    }
+    std::vector<unsigned long long> order(ids.size());
+    for (unsigned long long m = 0; m < ids.size(); m++) {
+	order[start[owners[m]]++] = m;
+    }
+    return order;
+}
+
+void ClusterStore::Group()
+{
+    if (grouped) {
+	return;
+    }
+    auto order = MemberOrder();
+    std::vector<unsigned long long> newIds(ids.size());
+    std::vector<int8_t> newStrands(ids.size());
+    std::vector<unsigned> newOwners(ids.size());
+    for (unsigned long long m = 0; m < order.size(); m++) {
+	newIds[m] = ids[order[m]];
+	newStrands[m] = strands[order[m]];
+	newOwners[m] = owners[order[m]];
+    }
+    ids.swap(newIds);
+    strands.swap(newStrands);
+    owners.swap(newOwners);
+    offsets.assign(reps.size() + 1, 0);
+    for (unsigned c = 0; c < reps.size(); c++) {
+	offsets[c + 1] = offsets[c] + sizes[c];
+    }
+    grouped = true;
+}
+
+void ClusterStore::Permute(const std::vector<unsigned>& order)
+{
+    if (order.size() != reps.size()) {
+	std::cerr << "Invalid cluster order!" << std::endl;
+	exit(1);
+    }
+    std::vector<ProcSeqP> newReps(reps.size());
+    std::vector<unsigned> newSizes(reps.size());
+    std::vector<unsigned> newIndex(reps.size());
+    for (unsigned i = 0; i < order.size(); i++) {
+	newReps[i] = std::move(reps[order[i]]);
+	newSizes[i] = sizes[order[i]];
+	newIndex[order[i]] = i;
+    }
+    reps.swap(newReps);
+    sizes.swap(newSizes);
+    for (auto& o : owners) {
+	o = newIndex[o];
+    }
+    grouped = false;
+    Group();
+}
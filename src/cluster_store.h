@@ -0,0 +1,69 @@
+#ifndef CLUSTER_STORE_H_INCLUDED
+#define CLUSTER_STORE_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+
+#include "cluster_data.h"
+
+/// Clusters as flat arrays: a table with the representative of each
+/// cluster, and for every member read its ordinal in the read store, its
+/// match strand and its cluster. Members can be appended to any cluster,
+/// Group orders them by cluster and fills in the cluster offsets.
+class ClusterStore {
+public:
+    unsigned Size() const { return unsigned(reps.size()); }
+    bool Empty() const { return reps.empty(); }
+    void Clear();
+    void Reserve(size_t nrCls, size_t nrMembers);
+    /// Add nrCls clusters without representatives or members.
+    void Resize(unsigned nrCls);
+    /// Add a cluster without members, returns its index.
+    unsigned Add(const ProcSeqP& rep);
+
+    ProcSeqP& Rep(unsigned c) { return reps[c]; }
+    const ProcSeqP& Rep(unsigned c) const { return reps[c]; }
+    unsigned NrMembers(unsigned c) const { return sizes[c]; }
+    unsigned long long NrMembers() const { return ids.size(); }
+
+    void AddMember(unsigned c, unsigned long long id, int strand);
+    /// Append the members of cluster oc of a grouped store to cluster c,
+    /// flipping their strands if flip is set.
+    void AddMembers(unsigned c, const ClusterStore& other, unsigned oc,
+		    bool flip);
+    /// Replace the members with arrays already grouped by cluster, with
+    /// counts[c] members in cluster c.
+    void AssignMembers(const std::vector<unsigned>& counts,
+		       const uint64_t* memberIds, const int8_t* memberStrands,
+		       unsigned long long nrMembers);
+
+    unsigned long long MemberId(unsigned long long m) const { return ids[m]; }
+    int MemberStrand(unsigned long long m) const { return strands[m]; }
+    unsigned MemberCluster(unsigned long long m) const { return owners[m]; }
+
+    /// Member indices ordered by cluster, keeping the order within clusters.
+    std::vector<unsigned long long> MemberOrder() const;
+    void Group();
+    bool Grouped() const { return grouped; }
+    /// Index of the first member of cluster c in a grouped store.
+    unsigned long long Offset(unsigned c) const { return offsets[c]; }
+    /// Reorder the clusters so that cluster order[i] becomes cluster i.
+    void Permute(const std::vector<unsigned>& order);
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+	archive(reps, sizes, ids, strands, owners, offsets, grouped);
+    }
+
+private:
+    std::vector<ProcSeqP> reps;
+    std::vector<unsigned> sizes;
+    std::vector<unsigned long long> ids;
+    std::vector<int8_t> strands;
+    std::vector<unsigned> owners;
+    std::vector<unsigned long long> offsets{0};
+    bool grouped{true};
+};
+
+#endif
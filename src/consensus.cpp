@@ -31,12 +31,13 @@ void AddSeqToGraphWeight(const std::string& seq,
     graph.release();
 }
 
-bool UpdateClusterConsensus(std::string& consName, Cluster& cl,
+bool UpdateClusterConsensus(std::string& consName, ProcSeq& rep,
 			    spoa::Graph* leftGraphPtr,
 			    spoa::Graph* rightGraphPtr, std::string& readSeq,
 			    double readRawErr, double readHpcErr,
 			    int matchStrand, int consMinSize, int consMaxSize,
-			    int kmerSize, int windowSize)
+			    int kmerSize, int windowSize, bool canonicalMins,
+			    bool hashMins, Arena* arena)
 {
     auto leftSize = leftGraphPtr->sequences().size();
     auto rightSize = leftSize;
@@ -45,20 +46,18 @@ bool UpdateClusterConsensus(std::string& consName, Cluster& cl,
     auto rs = readSeq;
 
     if (matchStrand == -1) {
-	RevComp(rs);
+	RevCompInPlace(rs);
     }
 
     if (rightGraphPtr != nullptr) {
 	rightSize = rightGraphPtr->sequences().size();
     }
 
-    auto clsRep = cl.at(0).get();
-
-    double hpcErr = (clsRep->HpcSeq->ErrorRate() * double(leftSize) +
+    double hpcErr = (rep.HpcSeq->ErrorRate() * double(leftSize) +
 		     readHpcErr * double(rightSize)) /
 		    double(leftSize + rightSize);
 
-    double rawErr = (clsRep->RawSeq->ErrorRate() * double(leftSize) +
+    double rawErr = (rep.RawSeq->ErrorRate() * double(leftSize) +
 		     readRawErr * double(rightSize)) /
 		    double(leftSize + rightSize);
 
@@ -89,46 +88,44 @@ bool UpdateClusterConsensus(std::string& consName, Cluster& cl,
 
     cons.reserve(cons.size());
     auto consLen = cons.length();
-    auto& rep = cl[0];
 
-    rep->RawSeq->SetStr(cons);
-    rep->RawSeq->SetName(consName);
-    rep->RawSeq->SetErrorRate(rawErr);
-    rep->RawSeq->SetScore(rawErr * double(cons.length()));
+    rep.RawSeq->SetStr(cons);
+    rep.RawSeq->SetName(consName);
+    rep.RawSeq->SetErrorRate(rawErr);
+    rep.RawSeq->SetScore(rawErr * double(cons.length()));
     auto fixedQualHpc = std::to_string(int(-10 * log10(hpcErr)) + 33)[0];
     auto fixedQualRaw = std::to_string(int(-10 * log10(rawErr)) + 33)[0];
-    rep->RawSeq->SetQual(std::string(cons.length(), fixedQualRaw));
+    rep.RawSeq->SetQual(QualStore::Const(fixedQualRaw, cons.length()));
 
     auto hpcSeq = std::unique_ptr<Seq>(new Seq);
 
     if (cons.length() > unsigned(2 * kmerSize) ||
 	cons.length() >= unsigned(windowSize)) {
-	*hpcSeq = HomopolymerCompressObj(*(rep->RawSeq));
+	*hpcSeq = HomopolymerCompressObj(*(rep.RawSeq), arena);
 	hpcSeq->SetErrorRate(hpcErr);
-	hpcSeq->SetScore(hpcErr * double(hpcSeq->Str().length()));
-	rep->HpcSeq->SetQual(std::string(hpcSeq->Str().length(), fixedQualHpc));
-	if (hpcSeq->Str().length() < unsigned(2 * kmerSize) ||
-	    hpcSeq->Str().length() < unsigned(windowSize)) {
+	hpcSeq->SetScore(hpcErr * double(hpcSeq->Len()));
+	rep.HpcSeq->SetQual(QualStore::Const(fixedQualHpc, hpcSeq->Len()));
+	if (hpcSeq->Len() < unsigned(2 * kmerSize) ||
+	    hpcSeq->Len() < unsigned(windowSize)) {
 	    hpcSeq->SetScore(-1.0);
-	    rep->RawSeq->SetScore(-1.0);
-	    rep->RawSeq->SetErrorRate(0.9999);
+	    rep.RawSeq->SetScore(-1.0);
+	    rep.RawSeq->SetErrorRate(0.9999);
 	    hpcSeq->SetErrorRate(0.9999);
 	}
     }
 
-    const auto& kmerSeq = KmerEncodeSeq(hpcSeq->Str(), kmerSize);
-    const auto& revKmerSeq = KmerEncodeSeq(RevComp(hpcSeq->Str()), kmerSize);
+    SeqMinimizers(*hpcSeq, kmerSize, windowSize, canonicalMins, hashMins,
+		  rep.Mins, rep.RevMins, arena);
     hpcSeq->SetErrorRate(hpcErr);
-    rep->HpcSeq = std::move(hpcSeq);
-    rep->Mins = GetKmerMinimizers(kmerSeq, kmerSize, windowSize);
-    rep->RevMins = GetKmerMinimizers(revKmerSeq, kmerSize, windowSize);
+    rep.HpcSeq = std::move(hpcSeq);
     return true;
 }
 
 std::unique_ptr<spoa::Graph> ConsPurge(spoa::Graph* graphPtr,
-				       spoa::AlignmentEngine* ae, Cluster& cl)
+				       spoa::AlignmentEngine* ae,
+				       const ProcSeq& rep)
 {
-    auto& repSeq = cl[0]->RawSeq->Str();
+    auto repSeq = rep.RawSeq->Str();
     auto w = graphPtr->sequences().size();
     graphPtr->Clear();
     auto newGraph = std::unique_ptr<spoa::Graph>(new spoa::Graph);
@@ -10,12 +10,13 @@
 #include "serialize.h"
 #include "spoa/spoa.hpp"
 
-bool UpdateClusterConsensus(std::string& consName, Cluster& cl,
+bool UpdateClusterConsensus(std::string& consName, ProcSeq& rep,
 			    spoa::Graph* leftGraphPtr,
 			    spoa::Graph* rightGraphPtr, std::string& readSeq,
 			    double readRawErr, double readHpcErr,
 			    int matchStrand, int consMinSize, int consMaxSize,
-			    int kmerSize, int windowSize);
+			    int kmerSize, int windowSize, bool canonicalMins,
+			    bool hashMins, Arena* arena = nullptr);
 
 void AddSeqToGraph(const std::string& seq, spoa::Graph* graphPtr,
 		   spoa::AlignmentEngine* ae, std::uint32_t weight);
@@ -25,6 +26,7 @@ void AddSeqToGraphWeight(const std::string& seq,
 			 spoa::Graph* graphPtr, spoa::AlignmentEngine* ae);
 
 std::unique_ptr<spoa::Graph> ConsPurge(spoa::Graph* graphPtr,
-				       spoa::AlignmentEngine* ae, Cluster& cl);
+				       spoa::AlignmentEngine* ae,
+				       const ProcSeq& rep);
 
 #endif
@@ -0,0 +1,320 @@
+#include "decompress.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+
+#include "tbb/parallel_for.h"
+#include "zlib.h"
+
+static inline unsigned le16(const unsigned char* p)
+{
+    return unsigned(p[0]) | (unsigned(p[1]) << 8);
+}
+
+static inline unsigned le32(const unsigned char* p)
+{
+    return le16(p) | (le16(p + 2) << 16);
+}
+
+/// Check for a gzip member header carrying the BGZF block size field.
+bool IsBgzfHeader(const unsigned char* h, size_t size)
+{
+    if (size < 18 || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 ||
+	!(h[3] & 4)) {
+	return false;
+    }
+    return le16(h + 10) >= 6 && h[12] == 'B' && h[13] == 'C' &&
+	   le16(h + 14) == 2;
+}
+
+std::unique_ptr<ByteSource> OpenByteSource(const std::string& inFile)
+{
+    auto fh = fopen(inFile.c_str(), "rb");
+    if (fh == nullptr) {
+	std::cerr << "Failed to open " + inFile + "!" << std::endl;
+	exit(1);
+    }
+    unsigned char h[18];
+    auto got = fread(h, 1, sizeof(h), fh);
+    rewind(fh);
+
+    if (IsBgzfHeader(h, got)) {
+	return std::unique_ptr<ByteSource>(new BgzfSource(fh));
+    }
+    if (got >= 2 && h[0] == 0x1f && h[1] == 0x8b) {
+	return std::unique_ptr<ByteSource>(new GzipSource(fh));
+    }
+    return std::unique_ptr<ByteSource>(new FileSource(fh));
+}
+
+unsigned long long InputSize(const std::string& inFile)
+{
+    auto fh = fopen(inFile.c_str(), "rb");
+    if (fh == nullptr) {
+	std::cerr << "Failed to open " + inFile + "!" << std::endl;
+	exit(1);
+    }
+    struct stat info;
+    fstat(fileno(fh), &info);
+    auto size = (unsigned long long)(info.st_size);
+    unsigned char h[18];
+    auto got = fread(h, 1, sizeof(h), fh);
+
+    auto res = size;
+    unsigned char isize[4];
+    if (IsBgzfHeader(h, got)) {
+	// Walk the block headers, truncated input is left to BgzfSource.
+	res = 0;
+	unsigned long long pos = 0;
+	while (pos + 18 <= size && fseeko(fh, off_t(pos), SEEK_SET) == 0 &&
+	       fread(h, 1, 18, fh) == 18 && IsBgzfHeader(h, 18)) {
+	    auto total = (unsigned long long)(le16(h + 16)) + 1;
+	    if (pos + total > size ||
+		fseeko(fh, off_t(pos + total - 4), SEEK_SET) != 0 ||
+		fread(isize, 1, 4, fh) != 4) {
+		break;
+	    }
+	    res += le32(isize);
+	    pos += total;
+	}
+    }
+    else if (got >= 2 && h[0] == 0x1f && h[1] == 0x8b && size >= 18 &&
+	     fseeko(fh, -4, SEEK_END) == 0 && fread(isize, 1, 4, fh) == 4) {
+	// ISIZE is taken modulo 4 GB, larger files decompress to more than
+	// their size.
+	res = le32(isize);
+	while (size >= (1ULL << 32) && res < size) {
+	    res += 1ULL << 32;
+	}
+    }
+    fclose(fh);
+    return res;
+}
+
+FileSource::FileSource(FILE* fh) : fh(fh)
+{
+    struct stat info;
+    fstat(fileno(fh), &info);
+    left = size_t(info.st_size);
+}
+
+FileSource::~FileSource() { fclose(fh); }
+
+size_t FileSource::Read(std::vector<char>& buf, size_t bytes)
+{
+    // Avoid growing the buffer past the end of small files.
+    bytes = std::min(bytes, left);
+    auto old = buf.size();
+    buf.resize(old + bytes);
+    auto got = fread(buf.data() + old, 1, bytes, fh);
+    buf.resize(old + got);
+    left -= got;
+    return got;
+}
+
+BgzfSource::~BgzfSource() { fclose(fh); }
+
+bool BgzfSource::readMore()
+{
+    if (eof) {
+	return false;
+    }
+    auto old = comp.size();
+    comp.resize(old + BGZF_READ_SIZE);
+    auto got = fread(comp.data() + old, 1, BGZF_READ_SIZE, fh);
+    comp.resize(old + got);
+    if (got == 0) {
+	eof = true;
+    }
+    return got > 0;
+}
+
+typedef struct {
+    size_t CompPos;
+    size_t CompLen;
+    size_t OutPos;
+    unsigned Size;
+    unsigned Crc;
+} bgzfBlock;
+
+size_t BgzfSource::Read(std::vector<char>& buf, size_t bytes)
+{
+    comp.erase(comp.begin(), comp.begin() + compPos);
+    compPos = 0;
+
+    // Collect whole blocks until enough output is planned. Offsets stay
+    // valid while comp grows.
+    std::vector<bgzfBlock> blocks;
+    size_t planned = 0;
+    while (planned < bytes) {
+	if (comp.size() - compPos < 18 && !readMore()) {
+	    if (comp.size() != compPos) {
+		std::cerr << "Truncated BGZF input!" << std::endl;
+		exit(1);
+	    }
+	    break;
+	}
+	if (comp.size() - compPos < 18) {
+	    continue;
+	}
+	auto h = reinterpret_cast<const unsigned char*>(comp.data() + compPos);
+	if (!IsBgzfHeader(h, 18)) {
+	    std::cerr << "Invalid BGZF block header!" << std::endl;
+	    exit(1);
+	}
+	auto xlen = le16(h + 10);
+	auto total = size_t(le16(h + 16)) + 1;
+	if (comp.size() - compPos < total) {
+	    if (!readMore()) {
+		std::cerr << "Truncated BGZF input!" << std::endl;
+		exit(1);
+	    }
+	    continue;
+	}
+	h = reinterpret_cast<const unsigned char*>(comp.data() + compPos);
+	bgzfBlock b;
+	b.CompPos = compPos + 12 + xlen;
+	b.CompLen = total - 12 - xlen - 8;
+	b.OutPos = planned;
+	b.Crc = le32(h + total - 8);
+	b.Size = le32(h + total - 4);
+	blocks.push_back(b);
+	planned += b.Size;
+	compPos += total;
+    }
+
+    auto old = buf.size();
+    buf.resize(old + planned);
+    tbb::parallel_for(size_t(0), blocks.size(), [&](size_t i) {
+	auto& b = blocks[i];
+	auto out = reinterpret_cast<unsigned char*>(buf.data() + old + b.OutPos);
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	inflateInit2(&zs, -15);
+	zs.next_in = reinterpret_cast<unsigned char*>(comp.data() + b.CompPos);
+	zs.avail_in = unsigned(b.CompLen);
+	zs.next_out = out;
+	zs.avail_out = b.Size;
+	auto ret = inflate(&zs, Z_FINISH);
+	auto size = zs.total_out;
+	inflateEnd(&zs);
+	if ((ret != Z_STREAM_END) || (size != b.Size) ||
+	    (crc32(0, out, b.Size) != b.Crc)) {
+	    std::cerr << "Corrupt BGZF block!" << std::endl;
+	    exit(1);
+	}
+    });
+
+    return planned;
+}
+
+GzipSource::GzipSource(FILE* fh) : fh(fh)
+{
+    worker = std::thread(&GzipSource::inflateLoop, this);
+}
+
+GzipSource::~GzipSource()
+{
+    {
+	std::lock_guard<std::mutex> lock(mtx);
+	stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+    fclose(fh);
+}
+
+void GzipSource::inflateLoop()
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, 15 + 16);
+    std::vector<unsigned char> in(GZIP_CHUNK_SIZE);
+    std::vector<char> out(GZIP_CHUNK_SIZE);
+    bool ended = true;
+
+    auto push = [&]() -> bool {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return queue.size() < GZIP_QUEUE_SIZE || stop; });
+	if (stop) {
+	    return false;
+	}
+	queue.push_back(std::move(out));
+	cv.notify_all();
+	return true;
+    };
+
+    size_t outPos = 0;
+    while (true) {
+	if (zs.avail_in == 0) {
+	    auto got = fread(in.data(), 1, in.size(), fh);
+	    if (got == 0) {
+		break;
+	    }
+	    zs.next_in = in.data();
+	    zs.avail_in = unsigned(got);
+	}
+	zs.next_out = reinterpret_cast<unsigned char*>(out.data() + outPos);
+	zs.avail_out = unsigned(out.size() - outPos);
+	auto ret = inflate(&zs, Z_NO_FLUSH);
+	if (ret == Z_STREAM_END) {
+	    // Concatenated gzip members.
+	    inflateReset(&zs);
+	    ended = true;
+	}
+	else if (ret == Z_OK) {
+	    ended = false;
+	}
+	else if (ret != Z_BUF_ERROR) {
+	    std::cerr << "Corrupt gzip input: " << ret << std::endl;
+	    exit(1);
+	}
+	outPos = out.size() - zs.avail_out;
+	if (outPos == out.size()) {
+	    if (!push()) {
+		inflateEnd(&zs);
+		return;
+	    }
+	    out = std::vector<char>(GZIP_CHUNK_SIZE);
+	    outPos = 0;
+	}
+    }
+    inflateEnd(&zs);
+
+    if (!ended) {
+	std::cerr << "Truncated gzip input!" << std::endl;
+	exit(1);
+    }
+    out.resize(outPos);
+    if (outPos > 0 && !push()) {
+	return;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    done = true;
+    cv.notify_all();
+}
+
+size_t GzipSource::Read(std::vector<char>& buf, size_t bytes)
+{
+    size_t got = 0;
+    while (got < bytes) {
+	if (headPos == head.size()) {
+	    std::unique_lock<std::mutex> lock(mtx);
+	    cv.wait(lock, [&] { return !queue.empty() || done; });
+	    if (queue.empty()) {
+		break;
+	    }
+	    head = std::move(queue.front());
+	    queue.pop_front();
+	    headPos = 0;
+	    cv.notify_all();
+	}
+	auto n = std::min(bytes - got, head.size() - headPos);
+	buf.insert(buf.end(), head.begin() + headPos, head.begin() + headPos + n);
+	headPos += n;
+	got += n;
+    }
+    return got;
+}
@@ -0,0 +1,83 @@
+#ifndef DECOMPRESS_H_INCLUDED
+#define DECOMPRESS_H_INCLUDED
+
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GZIP_CHUNK_SIZE (4 * 1024 * 1024)
+#define GZIP_QUEUE_SIZE 8
+#define BGZF_READ_SIZE (16 * 1024 * 1024)
+
+/// Sequential source of (decompressed) input bytes.
+class ByteSource {
+public:
+    virtual ~ByteSource() {}
+    /// Append about bytes of input to buf, BGZF input is rounded up to
+    /// whole blocks. Returns the number of bytes appended, zero at the end
+    /// of input.
+    virtual size_t Read(std::vector<char>& buf, size_t bytes) = 0;
+};
+
+/// Uncompressed file.
+class FileSource : public ByteSource {
+public:
+    explicit FileSource(FILE* fh);
+    ~FileSource();
+    size_t Read(std::vector<char>& buf, size_t bytes);
+
+private:
+    FILE* fh;
+    size_t left;
+};
+
+/// BGZF file: batches of blocks are inflated in parallel.
+class BgzfSource : public ByteSource {
+public:
+    explicit BgzfSource(FILE* fh) : fh(fh) {}
+    ~BgzfSource();
+    size_t Read(std::vector<char>& buf, size_t bytes);
+
+private:
+    bool readMore();
+
+    FILE* fh;
+    std::vector<char> comp;
+    size_t compPos{0};
+    bool eof{false};
+};
+
+/// Plain gzip file: a background thread inflates ahead of the parser.
+class GzipSource : public ByteSource {
+public:
+    explicit GzipSource(FILE* fh);
+    ~GzipSource();
+    size_t Read(std::vector<char>& buf, size_t bytes);
+
+private:
+    void inflateLoop();
+
+    FILE* fh;
+    std::thread worker;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::vector<char>> queue;
+    std::vector<char> head;
+    size_t headPos{0};
+    bool done{false};
+    bool stop{false};
+};
+
+bool IsBgzfHeader(const unsigned char* h, size_t size);
+/// Decompressed size of a file: the sum of the block sizes of BGZF input,
+/// the ISIZE trailer of gzip input, which only covers the last member, or
+/// the file size.
+unsigned long long InputSize(const std::string& inFile);
+std::unique_ptr<ByteSource> OpenByteSource(const std::string& inFile);
+
+#endif
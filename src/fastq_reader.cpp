@@ -0,0 +1,349 @@
+#include "fastq_reader.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#include "tbb/parallel_for.h"
+
+// Line starting at pos, without the trailing whitespace. Sets next to the
+// start of the following line, or returns false if the line is not
+// terminated by a newline before size.
+static bool getLine(const char* data, size_t pos, size_t size, size_t& len,
+		    size_t& next)
+{
+    auto nl = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+    if (nl == nullptr) {
+	return false;
+    }
+    next = size_t(nl - data) + 1;
+    len = next - 1 - pos;
+    while (len > 0 && std::isspace(data[pos + len - 1])) {
+	len--;
+    }
+    return true;
+}
+
+/// Return the first record start at or after from, or size if no record
+/// start can be validated. A line is taken as a header if it starts with
+/// '@', the line after the next starts with '+', and the sequence and
+/// quality lines have the same length.
+size_t FindRecordStart(const char* data, size_t from, size_t size)
+{
+    size_t pos = from;
+    if (pos > 0 && data[pos - 1] != '\n') {
+	auto nl = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+	if (nl == nullptr) {
+	    return size;
+	}
+	pos = size_t(nl - data) + 1;
+    }
+
+    while (pos < size) {
+	size_t hLen, sLen, pLen, qLen;
+	size_t sPos, pPos, qPos, next;
+	if (!getLine(data, pos, size, hLen, sPos)) {
+	    return size;
+	}
+	if (data[pos] == '@' && getLine(data, sPos, size, sLen, pPos) &&
+	    pPos < size && data[pPos] == '+' &&
+	    getLine(data, pPos, size, pLen, qPos) &&
+	    getLine(data, qPos, size, qLen, next) && sLen == qLen) {
+	    return pos;
+	}
+	pos = sPos;
+    }
+    return size;
+}
+
+FastqReader::FastqReader(const std::string& inFastq)
+    : source(OpenByteSource(inFastq))
+{
+}
+
+bool FastqReader::fill(size_t bytes)
+{
+    if (eof) {
+	return false;
+    }
+    if (source->Read(buf, bytes) == 0) {
+	eof = true;
+	return false;
+    }
+    return true;
+}
+
+/// Parse the records in data[0, size). Unless final is set, an incomplete
+/// record at the end is left alone. Returns the number of bytes consumed.
+size_t FastqReader::ParseRecords(const char* data, size_t size, bool final,
+				 SequencesP& out)
+{
+    size_t pos = 0;
+    size_t consumed = 0;
+    size_t len, next;
+    std::string seq;
+    std::string qual;
+
+    // A last line without a newline is complete only at the end of input.
+    auto line = [&](size_t p) -> bool {
+	if (p >= size) {
+	    return false;
+	}
+	if (getLine(data, p, size, len, next)) {
+	    return true;
+	}
+	if (!final) {
+	    return false;
+	}
+	len = size - p;
+	while (len > 0 && std::isspace(data[p + len - 1])) {
+	    len--;
+	}
+	next = size;
+	return true;
+    };
+
+    while (pos < size) {
+	if (!line(pos)) {
+	    break;
+	}
+	if (len == 0) {
+	    pos = next;
+	    consumed = pos;
+	    continue;
+	}
+	if (data[pos] != '@') {
+	    std::cerr << "Invalid fastq record header: "
+		      << std::string(data + pos, len) << std::endl;
+	    exit(1);
+	}
+	auto name = data + pos + 1;
+	size_t nameLen = 0;
+	while (nameLen < len - 1 && !std::isspace(name[nameLen])) {
+	    nameLen++;
+	}
+	pos = next;
+
+	seq.clear();
+	bool complete = false;
+	while (line(pos)) {
+	    if (len > 0 && data[pos] == '+') {
+		complete = true;
+		pos = next;
+		break;
+	    }
+	    seq.append(data + pos, len);
+	    pos = next;
+	}
+	if (!complete) {
+	    break;
+	}
+
+	qual.clear();
+	while (qual.size() < seq.size() && line(pos)) {
+	    qual.append(data + pos, len);
+	    pos = next;
+	}
+	if (qual.size() < seq.size()) {
+	    if (final) {
+		std::cerr << "Truncated fastq record: "
+			  << std::string(name, nameLen) << std::endl;
+		exit(1);
+	    }
+	    break;
+	}
+	if (nameLen == 0 || seq.size() == 0 || qual.size() != seq.size()) {
+	    std::cerr << "Invalid fastq record: " << std::string(name, nameLen)
+		      << std::endl;
+	    exit(1);
+	}
+
+	out.emplace_back(new Seq(name, nameLen, seq.data(), seq.size(),
+				 qual.data(), qual.size()));
+	consumed = pos;
+    }
+
+    return consumed;
+}
+
+SequencesP FastqReader::Parse(unsigned long long bytes)
+{
+    SequencesP res;
+    unsigned long long parsed = 0;
+
+    while (parsed < bytes) {
+	auto want = std::min<unsigned long long>(bytes - parsed,
+						 FASTQ_BLOCK_SIZE);
+	if (!fill(want) && buf.size() == 0) {
+	    break;
+	}
+
+	// Split the block into chunks starting at record boundaries.
+	auto size = buf.size();
+	auto data = buf.data();
+	std::vector<size_t> starts{0};
+	for (size_t p = FASTQ_CHUNK_SIZE; p < size; p += FASTQ_CHUNK_SIZE) {
+	    auto s = FindRecordStart(data, std::max(p, starts.back() + 1), size);
+	    if (s >= size) {
+		break;
+	    }
+	    starts.push_back(s);
+	}
+	starts.push_back(size);
+
+	auto nrChunks = starts.size() - 1;
+	std::vector<SequencesP> chunkSeqs(nrChunks);
+	std::vector<size_t> consumed(nrChunks);
+	tbb::parallel_for(size_t(0), nrChunks, [&](size_t i) {
+	    bool last = (i == nrChunks - 1);
+	    consumed[i] =
+		ParseRecords(data + starts[i], starts[i + 1] - starts[i],
+			     !last || eof, chunkSeqs[i]);
+	});
+
+	size_t total = 0;
+	for (auto& c : chunkSeqs) {
+	    total += c.size();
+	}
+	res.reserve(res.size() + total);
+	for (auto& c : chunkSeqs) {
+	    std::move(c.begin(), c.end(), std::back_inserter(res));
+	}
+
+	auto used = starts[nrChunks - 1] + consumed[nrChunks - 1];
+	if (used == 0 && eof) {
+	    break;
+	}
+	buf.erase(buf.begin(), buf.begin() + used);
+	parsed += used;
+	if (eof && buf.size() == 0) {
+	    break;
+	}
+    }
+
+    return res;
+}
+
+SequencesP ParseFastqParallel(const std::string& inFastq)
+{
+    FastqReader reader(inFastq);
+    return reader.Parse(-1);
+}
+
+MultiFastqReader::MultiFastqReader(const std::vector<std::string>& inFiles)
+    : files(inFiles)
+{
+}
+
+SequencesP MultiFastqReader::Parse(unsigned long long bytes)
+{
+    SequencesP res;
+    if (current != nullptr) {
+	res = current->Parse(bytes);
+	if (res.size() > 0) {
+	    return res;
+	}
+	current = nullptr;
+    }
+    if (next == files.size()) {
+	return res;
+    }
+
+    // A file larger than the chunk is read chunk by chunk on its own. Sizes
+    // are decompressed ones, as the chunk is.
+    if (InputSize(files[next]) >= bytes) {
+	current = std::unique_ptr<FastqReader>(new FastqReader(files[next]));
+	next++;
+	return Parse(bytes);
+    }
+
+    // Otherwise take whole files up to the chunk size and parse them
+    // concurrently, keeping the file order.
+    unsigned long long taken = 0;
+    auto first = next;
+    while (next < files.size() && taken < bytes) {
+	auto size = InputSize(files[next]);
+	if (taken > 0 && taken + size > bytes) {
+	    break;
+	}
+	taken += size;
+	next++;
+    }
+    std::vector<SequencesP> parts(next - first);
+    tbb::parallel_for(size_t(0), parts.size(), [&](size_t i) {
+	parts[i] = ParseFastqParallel(files[first + i]);
+    });
+
+    size_t total = 0;
+    for (auto& p : parts) {
+	total += p.size();
+    }
+    res.reserve(total);
+    for (auto& p : parts) {
+	std::move(p.begin(), p.end(), std::back_inserter(res));
+    }
+    if (res.size() == 0) {
+	return Parse(bytes);
+    }
+    return res;
+}
+
+static bool hasSuffix(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() &&
+	   s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool isFastqName(const std::string& name)
+{
+    std::vector<std::string> exts{".fq", ".fastq"};
+    std::vector<std::string> comps{"", ".gz", ".bgz", ".bgzf"};
+    for (auto& e : exts) {
+	for (auto& c : comps) {
+	    if (hasSuffix(name, e + c)) {
+		return true;
+	    }
+	}
+    }
+    return false;
+}
+
+/// Replace directories in the input list by the fastq files they contain,
+/// in lexicographic order so that read order is reproducible.
+std::vector<std::string> ExpandFastqInputs(
+    const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> res;
+    for (auto& in : inputs) {
+	struct stat info;
+	if (stat(in.c_str(), &info) != 0) {
+	    std::cerr << "Failed to open " + in + "!" << std::endl;
+	    exit(1);
+	}
+	if (!(info.st_mode & S_IFDIR)) {
+	    res.push_back(in);
+	    continue;
+	}
+	auto dir = opendir(in.c_str());
+	if (dir == nullptr) {
+	    std::cerr << "Failed to open directory " + in + "!" << std::endl;
+	    exit(1);
+	}
+	std::vector<std::string> names;
+	for (auto e = readdir(dir); e != nullptr; e = readdir(dir)) {
+	    std::string name(e->d_name);
+	    if (isFastqName(name)) {
+		names.push_back(name);
+	    }
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	for (auto& n : names) {
+	    res.push_back(in + "/" + n);
+	}
+    }
+    return res;
+}
@@ -0,0 +1,58 @@
+#ifndef FASTQ_READER_H_INCLUDED
+#define FASTQ_READER_H_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decompress.h"
+#include "seq.h"
+
+#define FASTQ_BLOCK_SIZE (64ULL * 1024 * 1024)
+#define FASTQ_CHUNK_SIZE (4ULL * 1024 * 1024)
+
+/// Multithreaded fastq parser. The input is read in large blocks which are
+/// split at record boundaries and parsed in parallel. Record names are
+/// shortened at the first whitespace, like bioparser does. Gzip and BGZF
+/// input is decompressed on the fly.
+class FastqReader {
+public:
+    explicit FastqReader(const std::string& inFastq);
+
+    /// Parse at least the given number of input bytes, rounded up to whole
+    /// records. Returns an empty vector once the input is exhausted.
+    SequencesP Parse(unsigned long long bytes);
+
+    static size_t ParseRecords(const char* data, size_t size, bool final,
+			       SequencesP& out);
+
+private:
+    bool fill(size_t bytes);
+
+    std::unique_ptr<ByteSource> source;
+    std::vector<char> buf;
+    bool eof{false};
+};
+
+/// Reads a list of fastq files in order. Small files are parsed
+/// concurrently, large ones chunk by chunk.
+class MultiFastqReader {
+public:
+    explicit MultiFastqReader(const std::vector<std::string>& inFiles);
+
+    /// Parse at least the given number of input bytes, rounded up to whole
+    /// records. Returns an empty vector once all files are exhausted.
+    SequencesP Parse(unsigned long long bytes);
+
+private:
+    std::vector<std::string> files;
+    size_t next{0};
+    std::unique_ptr<FastqReader> current;
+};
+
+size_t FindRecordStart(const char* data, size_t from, size_t size);
+SequencesP ParseFastqParallel(const std::string& inFastq);
+std::vector<std::string> ExpandFastqInputs(
+    const std::vector<std::string>& inputs);
+
+#endif
@@ -1,63 +1,206 @@
 #include "hpc.h"
+#include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
-Seq* HomopolymerCompress(const std::unique_ptr<Seq>& s)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HPC_BLOCK 16
+
+typedef std::vector<char, ArenaAllocator<char>> CharScratch;
+
+// Running maximum of the qualities of a block, restarted at the runs
+// starting in the bits of starts. Positions before the first start go on
+// with the run of the previous block, which had reached carry.
+static void runMaxima(const char* qual, uint32_t starts, char carry,
+		      char* out)
 {
-    std::string compSeq;
-    std::string compQual;
-    auto& seq = s->Str();
-    compSeq.reserve(seq.length());
-    compQual.reserve(seq.length());
-    auto& qual = s->Qual();
-    char currBase = seq[0];
-    char currQual = qual[0];
-
-    compSeq += currBase;
-
-    for (unsigned i = 1; i < seq.length(); i++) {
-	if (seq[i] != currBase) {
-	    currBase = seq[i];
-	    compSeq += currBase;
-	    compQual += currQual;
-	    currQual = qual[i];
+#if defined(__SSE2__)
+    auto q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qual));
+    if ((starts & 1) == 0) {
+	q = _mm_max_epu8(q, _mm_cvtsi32_si128(int(uint8_t(carry))));
+    }
+    // Spread the start bits to 0xff bytes.
+    auto f = _mm_cvtsi32_si128(int(starts));
+    f = _mm_unpacklo_epi8(f, f);
+    f = _mm_unpacklo_epi16(f, f);
+    f = _mm_unpacklo_epi32(f, f);
+    auto bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16,
+			      32, 64, -128);
+    f = _mm_cmpeq_epi8(_mm_and_si128(f, bits), bits);
+    // Segmented scan: a lane takes the maximum of the lane d before it,
+    // unless a run starts in between.
+    q = _mm_max_epu8(q, _mm_andnot_si128(f, _mm_slli_si128(q, 1)));
+    f = _mm_or_si128(f, _mm_slli_si128(f, 1));
+    q = _mm_max_epu8(q, _mm_andnot_si128(f, _mm_slli_si128(q, 2)));
+    f = _mm_or_si128(f, _mm_slli_si128(f, 2));
+    q = _mm_max_epu8(q, _mm_andnot_si128(f, _mm_slli_si128(q, 4)));
+    f = _mm_or_si128(f, _mm_slli_si128(f, 4));
+    q = _mm_max_epu8(q, _mm_andnot_si128(f, _mm_slli_si128(q, 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), q);
+#else
+    auto m = carry;
+    for (unsigned j = 0; j < HPC_BLOCK; j++) {
+	m = ((starts >> j) & 1) != 0 ? qual[j] : std::max(m, qual[j]);
+	out[j] = m;
+    }
+#endif
+}
+
+// Collapse runs a block of HPC_BLOCK positions at a time. startsOf(i, size)
+// gives the run starts among positions i .. i + size - 1 as bits, and
+// emit(r, i) writes the base of run r, which starts at position i.
+template <typename StartsFn, typename EmitFn>
+static unsigned compressBlocks(unsigned len, const char* qual,
+			       StartsFn startsOf, EmitFn emit, char* outQual)
+{
+    unsigned n = 0;
+    char tail[HPC_BLOCK];
+    // The maximum up to the position before each one of the block, so
+    // that a run start gives the quality of the run it ends.
+    char before[HPC_BLOCK + 1] = {0};
+    // Quality of the open run, written when it ends.
+    char unused;
+    auto open = &unused;
+    for (unsigned i = 0; i < len; i += HPC_BLOCK) {
+	auto size = std::min(unsigned(HPC_BLOCK), len - i);
+	auto q = qual + i;
+	if (size < HPC_BLOCK) {
+	    memset(tail, 0, HPC_BLOCK);
+	    memcpy(tail, q, size);
+	    q = tail;
 	}
-	else if (currQual < qual[i]) {
-	    currQual = qual[i];
+	auto starts = startsOf(i, size);
+	before[0] = before[HPC_BLOCK];
+	runMaxima(q, starts, before[0], before + 1);
+	for (auto s = starts; s != 0; s &= s - 1) {
+	    auto j = unsigned(__builtin_ctz(s));
+	    *open = before[j];
+	    open = outQual + n;
+	    emit(n++, i + j);
+	}
+	if (size < HPC_BLOCK) {
+	    before[HPC_BLOCK] = before[size];
 	}
     }
-    compQual += currQual;
-
-    auto res = new Seq(s->Name(), compSeq, compQual, s->Score());
-    return res;
+    *open = before[HPC_BLOCK];
+    return n;
 }
 
-Seq HomopolymerCompressObj(const Seq& s)
+// Run starts of a block of characters: the vector loop compares the block
+// with the block shifted by one.
+static uint32_t charStarts(const char* seq, unsigned i, unsigned size)
 {
-    std::string compSeq;
-    std::string compQual;
-    auto& seq = s.Str();
-    compSeq.reserve(seq.length());
-    compQual.reserve(seq.length());
-    auto& qual = s.Qual();
-    char currBase = seq[0];
-    char currQual = qual[0];
-
-    compSeq += currBase;
-
-    for (unsigned i = 1; i < seq.length(); i++) {
-	if (seq[i] != currBase) {
-	    currBase = seq[i];
-	    compSeq += currBase;
-	    compQual += currQual;
-	    currQual = qual[i];
-	}
-	else if (currQual < qual[i]) {
-	    currQual = qual[i];
+#if defined(__SSE2__)
+    if (i > 0 && size == HPC_BLOCK) {
+	auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+	auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i - 1));
+	return ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) & 0xffff;
+    }
+#endif
+    uint32_t starts = 0;
+    for (unsigned j = 0; j < size; j++) {
+	if (i + j == 0 || seq[i + j] != seq[i + j - 1]) {
+	    starts |= 1u << j;
 	}
     }
-    compQual += currQual;
+    return starts;
+}
+
+// Run starts of a block of 2-bit codes, sixteen to a word: a base starts a
+// run if its code differs from the one before.
+static uint32_t packedStarts(const uint8_t* bytes, unsigned i, unsigned size)
+{
+    uint32_t codes = 0;
+    memcpy(&codes, bytes + i / 4, (size + 3) / 4);
+    auto prev = codes << 2;
+    if (i > 0) {
+	prev |= uint32_t(bytes[i / 4 - 1] >> 6);
+    }
+    auto diff = codes ^ prev;
+    diff = (diff | diff >> 1) & 0x55555555u;
+    // Gather the bit of every code into the low 16 bits.
+    diff = (diff | diff >> 1) & 0x33333333u;
+    diff = (diff | diff >> 2) & 0x0f0f0f0fu;
+    diff = (diff | diff >> 4) & 0x00ff00ffu;
+    diff = (diff | diff >> 8) & 0x0000ffffu;
+    if (i == 0) {
+	diff |= 1;
+    }
+    return size < HPC_BLOCK ? diff & ((1u << size) - 1) : diff;
+}
 
-    auto res = Seq(s.Name(), compSeq, compQual, s.Score());
-    return res;
+unsigned CompressRuns(const char* seq, const char* qual, unsigned len,
+		      char* outSeq, char* outQual)
+{
+    return compressBlocks(
+	len, qual,
+	[seq](unsigned i, unsigned size) { return charStarts(seq, i, size); },
+	[seq, outSeq](unsigned r, unsigned i) { outSeq[r] = seq[i]; },
+	outQual);
 }
 
+// Reads without exceptions are compressed on their 2-bit codes and packed
+// as they go, others on the unpacked bases. Full qualities are read in
+// place.
+static PackedSeq compressSeq(const Seq& s, Arena* arena,
+			     std::string& compQual)
+{
+    auto& p = s.Packed();
+    auto len = p.Len();
+    if (len == 0) {
+	compQual.clear();
+	return PackedSeq();
+    }
+    std::string quals;
+    auto qual = s.Quals().Data().data();
+    if (s.Quals().Kind() != QualFull) {
+	quals = s.Qual();
+	qual = quals.data();
+    }
+    CharScratch outQual(len, 0, ArenaAllocator<char>(arena));
+    if (p.Exceptions().empty()) {
+	auto bytes = p.Bytes().data();
+	std::vector<uint8_t, ArenaAllocator<uint8_t>> out(
+	    p.Bytes().size(), 0, ArenaAllocator<uint8_t>(arena));
+	auto n = compressBlocks(
+	    len, qual,
+	    [bytes](unsigned i, unsigned size) {
+		return packedStarts(bytes, i, size);
+	    },
+	    [bytes, &out](unsigned r, unsigned i) {
+		auto code = (bytes[i / 4] >> (2 * (i % 4))) & 3;
+		out[r / 4] |= uint8_t(code << (2 * (r % 4)));
+	    },
+	    outQual.data());
+	compQual.assign(outQual.data(), n);
+	return PackedSeq(n, out.data(), nullptr, nullptr, 0);
+    }
+    CharScratch seq(len, 0, ArenaAllocator<char>(arena));
+    CharScratch outSeq(len, 0, ArenaAllocator<char>(arena));
+    p.UnpackTo(seq.data());
+    auto n = CompressRuns(seq.data(), qual, len, outSeq.data(), outQual.data());
+    compQual.assign(outQual.data(), n);
+    return PackedSeq(outSeq.data(), n);
+}
+
+Seq* HomopolymerCompress(const std::unique_ptr<Seq>& s, Arena* arena)
+{
+    std::string compQual;
+    auto compSeq = compressSeq(*s, arena, compQual);
+    auto n = unsigned(compQual.size());
+    return new Seq(s->Name(), std::move(compSeq),
+		   QualStore(QualFull, n, std::move(compQual)), s->Score());
+}
+
+Seq HomopolymerCompressObj(const Seq& s, Arena* arena)
+{
+    std::string compQual;
+    auto compSeq = compressSeq(s, arena, compQual);
+    auto n = unsigned(compQual.size());
+    return Seq(s.Name(), std::move(compSeq),
+	       QualStore(QualFull, n, std::move(compQual)), s.Score());
+}
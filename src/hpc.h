@@ -1,9 +1,20 @@
 #ifndef HPC_H_INCLUDED
 #define HPC_H_INCLUDED
 
+#include "arena.h"
 #include "seq.h"
 
-Seq* HomopolymerCompress(const std::unique_ptr<Seq>& s);
-Seq HomopolymerCompressObj(const Seq& s);
+/// Homopolymer compression kernel: writes the first base of every run of
+/// equal characters in seq to outSeq and the highest quality of the run
+/// to outQual. Both need room for len characters. Returns the number of
+/// runs.
+unsigned CompressRuns(const char* seq, const char* qual, unsigned len,
+		      char* outSeq, char* outQual);
+
+/// Homopolymer compressed copy of s, with its scratch space in arena if
+/// one is given.
+Seq* HomopolymerCompress(const std::unique_ptr<Seq>& s,
+			 Arena* arena = nullptr);
+Seq HomopolymerCompressObj(const Seq& s, Arena* arena = nullptr);
 
 #endif
@@ -1,17 +1,130 @@
 #include "kmer_index.h"
 #include <string>
 #include <vector>
+#include <algorithm>
 
-KmerSeq KmerEncodeSeq(const std::string seq, unsigned kmerSize)
+KmerSeq KmerEncodeSeq(const std::string seq, unsigned kmerSize, Arena* arena)
 {
-    std::vector<unsigned> res;
-    if (seq.length() < kmerSize) {
+    KmerSeq res{ArenaAllocator<unsigned>(arena)};
+    RollKmers(unsigned(seq.length()), kmerSize,
+	      [&seq](unsigned i) { return int(BaseToNumber(seq[i])); }, res);
+    return res;
+}
+
+// Roll over the bases of a strand, the reverse complement one reading the
+// codes backwards and complemented.
+template <typename Word, typename Alloc, typename CodeFn>
+static void rollStrand(unsigned len, unsigned kmerSize, bool revComp,
+		       CodeFn code, std::vector<Word, Alloc>& res)
+{
+    if (!revComp) {
+	RollKmers(len, kmerSize, code, res);
+	return;
+    }
+    RollKmers(len, kmerSize,
+	      [len, &code](unsigned i) {
+		  auto c = code(len - 1 - i);
+		  return c < 0 ? -1 : 3 - c;
+	      },
+	      res);
+}
+
+// Same encoding as above, taking the bases from their 2-bit codes. Reads
+// with other characters go through a code array.
+template <typename Word, typename Alloc>
+static void rollPacked(const PackedSeq& seq, unsigned kmerSize, bool revComp,
+		       std::vector<Word, Alloc>& res, Arena* arena)
+{
+    auto len = seq.Len();
+    auto bytes = seq.Bytes().data();
+    if (seq.Exceptions().empty()) {
+	rollStrand(len, kmerSize, revComp,
+		   [bytes](unsigned i) {
+		       return int((bytes[i / 4] >> (2 * (i % 4))) & 3);
+		   },
+		   res);
+	return;
+    }
+    std::vector<int8_t, ArenaAllocator<int8_t>> codes(
+	len, 0, ArenaAllocator<int8_t>(arena));
+    for (unsigned i = 0; i < len; i++) {
+	codes[i] = int8_t((bytes[i / 4] >> (2 * (i % 4))) & 3);
+    }
+    for (auto& e : seq.Exceptions()) {
+	codes[e.Pos] = -1;
+    }
+    rollStrand(len, kmerSize, revComp,
+	       [&codes](unsigned i) { return int(codes[i]); }, res);
+}
+
+KmerSeq KmerEncodeSeq(const PackedSeq& seq, unsigned kmerSize, Arena* arena)
+{
+    KmerSeq res{ArenaAllocator<unsigned>(arena)};
+    rollPacked(seq, kmerSize, false, res, arena);
+    return res;
+}
+
+KmerSeq KmerEncodeRevComp(const PackedSeq& seq, unsigned kmerSize,
+			  Arena* arena)
+{
+    KmerSeq res{ArenaAllocator<unsigned>(arena)};
+    rollPacked(seq, kmerSize, true, res, arena);
+    return res;
+}
+
+KmerSeq KmerEncodeCanonical(const PackedSeq& seq, unsigned kmerSize,
+			    KmerStrands& strands, Arena* arena)
+{
+    KmerSeq res{ArenaAllocator<unsigned>(arena)};
+    strands.clear();
+    auto len = seq.Len();
+    if (len < kmerSize || kmerSize == 0) {
 	return res;
     }
-    res.reserve(seq.length() - kmerSize);
-    for (unsigned i = 0; i < seq.length() - kmerSize; i++) {
-	auto kmer = seq.substr(i, kmerSize);
-	res.emplace_back(KmerToIndex(kmer, kmer.end()));
+    auto bytes = seq.Bytes().data();
+    auto& exc = seq.Exceptions();
+    auto nextExc = exc.begin();
+    // Codes are rolled in 64 bits so that both orientations compare in full.
+    uint64_t mask = kmerSize >= 32 ? ~uint64_t(0)
+				   : (uint64_t(1) << (2 * kmerSize)) - 1;
+    auto topShift = 2 * (kmerSize - 1);
+    uint64_t fwd = 0;
+    uint64_t rev = 0;
+    // Start of the first k-mer clear of exceptions.
+    unsigned clean = 0;
+    res.reserve(len - kmerSize);
+    strands.reserve(len - kmerSize);
+    for (unsigned i = 0; i + 1 < len; i++) {
+	uint64_t c = (bytes[i / 4] >> (2 * (i % 4))) & 3;
+	if (nextExc != exc.end() && nextExc->Pos == i) {
+	    clean = i + 1;
+	    ++nextExc;
+	}
+	fwd = ((fwd << 2) | c) & mask;
+	rev = (rev >> 2) | ((3 - c) << topShift);
+	if (i + 1 < kmerSize) {
+	    continue;
+	}
+	auto start = i + 1 - kmerSize;
+	if (start < clean) {
+	    // Same value as KmerEncodeSeq, exceptions count as -1.
+	    unsigned index = 0;
+	    auto e = exc.begin();
+	    for (unsigned j = start; j <= i; j++) {
+		while (e != exc.end() && e->Pos < j) {
+		    ++e;
+		}
+		auto code = (e != exc.end() && e->Pos == j)
+				? unsigned(-1)
+				: unsigned(bytes[j / 4] >> (2 * (j % 4))) & 3;
+		index = 4 * index + code;
+	    }
+	    res.emplace_back(index);
+	    strands.emplace_back(1);
+	    continue;
+	}
+	res.emplace_back(unsigned(std::min(fwd, rev)));
+	strands.emplace_back(rev < fwd ? -1 : 1);
     }
     return res;
 }
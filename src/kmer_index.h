@@ -4,9 +4,56 @@
 #include<string>
 #include<vector>
 #include<iostream>
+#include <stdint.h>
+#include "arena.h"
+#include "packed_seq.h"
 
-typedef std::vector<unsigned> KmerSeq;
-KmerSeq KmerEncodeSeq(const std::string seq, unsigned kmerSize);
+/// K-mer codes, in scratch space from an Arena if one is given.
+typedef std::vector<unsigned, ArenaAllocator<unsigned>> KmerSeq;
+KmerSeq KmerEncodeSeq(const std::string seq, unsigned kmerSize,
+		      Arena* arena = nullptr);
+KmerSeq KmerEncodeSeq(const PackedSeq& seq, unsigned kmerSize,
+		      Arena* arena = nullptr);
+/// K-mer codes of the reverse complement, as KmerEncodeSeq of RevComp of
+/// the bases gives, without building the reverse complement.
+KmerSeq KmerEncodeRevComp(const PackedSeq& seq, unsigned kmerSize,
+			  Arena* arena = nullptr);
+
+/// Rolling k-mer encoder: appends the codes of the k-mers starting at
+/// 0 .. len - k - 1, where code(i) gives the 2-bit code of base i or -1
+/// for other characters. Each step is index = 4 * index - 4^k * out + in
+/// in Word arithmetic, which gives the same value as encoding every k-mer
+/// from scratch. Codes are unsigned, so k-mers longer than 16 keep the
+/// code of their last 16 bases, as the recursive encoding did.
+template <typename Word, typename Alloc, typename CodeFn>
+void RollKmers(unsigned len, unsigned kmerSize, CodeFn code,
+	       std::vector<Word, Alloc>& out)
+{
+    if (len < kmerSize) {
+	return;
+    }
+    Word top = 1;
+    for (unsigned j = 0; j < kmerSize; j++) {
+	top *= 4;
+    }
+    Word index = 0;
+    for (unsigned j = 0; j < kmerSize; j++) {
+	index = 4 * index + Word(code(j));
+    }
+    out.reserve(out.size() + len - kmerSize);
+    for (unsigned i = 0; i + kmerSize < len; i++) {
+	out.emplace_back(index);
+	index = 4 * index - top * Word(code(i)) + Word(code(i + kmerSize));
+    }
+}
+/// Orientation of canonical k-mers: -1 if the reverse complement code was
+/// taken, 1 otherwise.
+typedef std::vector<int8_t, ArenaAllocator<int8_t>> KmerStrands;
+/// Canonical k-mer codes at the positions KmerEncodeSeq gives: the smaller
+/// of the forward and reverse complement code. K-mers with bases other
+/// than ACGT keep their forward code.
+KmerSeq KmerEncodeCanonical(const PackedSeq& seq, unsigned kmerSize,
+			    KmerStrands& strands, Arena* arena = nullptr);
 
 inline char NumberToBase(unsigned i) {
     switch (i){
@@ -4,12 +4,15 @@
 #include "serialize.h"
 
 #include "args.h"
+#include "batch_file.h"
 #include "bioparser/parser.hpp"
 #include "cluster.h"
+#include "fastq_reader.h"
 #include "minimizer.h"
 #include "output.h"
 #include "p_emp_prob.h"
 #include "qualscore.h"
+#include "sort_stream.h"
 #include "spoa/spoa.hpp"
 #include "util.h"
 
@@ -19,11 +22,11 @@ int mainCluster(int argc, char* argv[]);
 int mainDump(int argc, char* argv[]);
 int mainInfo(int argc, char* argv[]);
 void printBatchInfo(BatchP& b);
+void printBatchSummary(const Batch& b, const BatchSummary& s);
 void dumpBatchInfo(BatchP& b, std::string outfile);
 void dumpClusters(BatchP& b, std::string outdir, SortedIdx* idx);
 
 extern std::unique_ptr<spoa::AlignmentEngine> SpoaEngine;
-extern UnsignedHash uh;
 
 using namespace std;
 int main(int argc, char* argv[])
@@ -102,21 +105,37 @@ int mainSort(int argc, char* argv[])
 	cerr << "Debug output: " << (cmdArgs->Debug ? "on" : "off") << endl;
     }
 
+    cmdArgs->InFastqs = ExpandFastqInputs(cmdArgs->InFastqs);
+    if (cmdArgs->InFastqs.size() == 0) {
+	cerr << "No input fastq files found!" << endl;
+	exit(1);
+    }
+    if (VERBOSE) {
+	cerr << "Input fastq files: " << cmdArgs->InFastqs.size() << endl;
+    }
+
     auto batchDir = cmdArgs->BatchOutFolder + "/batches";
     CreateOutdir(cmdArgs->BatchOutFolder);
     CreateOutdir(batchDir);
 
-    auto fqParser = bioparser::Parser<Seq>::Create<bioparser::FastqParser>(cmdArgs->InFastq);
+    auto qualTab = InitQualTab();
+    auto qualTabNomin = InitQualTabNomin();
 
-    SequencesP sequences;
-	sequences = fqParser->Parse(-1);
+    if (cmdArgs->MemBudget > 0) {
+	if (VERBOSE) {
+	    cerr << "Streaming sort with memory budget: " << cmdArgs->MemBudget
+		 << " megabytes" << endl;
+	}
+	StreamingSort(*cmdArgs, batchDir, qualTab, qualTabNomin);
+	return 0;
+    }
+
+    SequencesP sequences = MultiFastqReader(cmdArgs->InFastqs).Parse(-1);
 
     if (VERBOSE) {
 	cerr << "Parsed " << sequences.size() << " sequences." << endl;
     }
 
-    auto qualTab = InitQualTab();
-    auto qualTabNomin = InitQualTabNomin();
     FillQualScores(sequences, cmdArgs->KmerSize, cmdArgs->WindowSize, qualTab,
 		   qualTabNomin);
     SortByQualScores(sequences);
@@ -124,78 +143,34 @@ int mainSort(int argc, char* argv[])
     if (VERBOSE) {
 	cerr << "Finished sorting sequences." << endl;
     }
-    string sortedFastq = cmdArgs->BatchOutFolder + "/sorted_reads.fastq";
-    SequencesPToFastq(sequences, sortedFastq,
-		      cmdArgs->BatchOutFolder + "/sorted_reads_idx.tsv",
-		      cmdArgs->BatchOutFolder + "/sorted_reads_idx.cer");
     if (VERBOSE) {
-	cerr << "Sorted sequences written to: " << sortedFastq << endl;
+	cerr << "Writing sorted sequences and preparing batches:" << endl;
     }
-    string scoresTsv = cmdArgs->BatchOutFolder + "/scores.tsv";
-    WriteScores(sequences, scoresTsv);
+    // The writer runs on this thread while earlier batches are prepared
+    // and saved concurrently by the batch builder.
+    auto bounds = BatchBoundaries(sequences, *cmdArgs);
     if (VERBOSE) {
-	cerr << "Scores written to: " << scoresTsv << endl;
-    }
-
-    if (VERBOSE) {
-	cerr << "Preparing batches:" << endl;
-    }
-    unsigned long batchBases{0};
-    int batchSeqs{0};
-    int nrBatches{0};
-    int batchStart{0};
-    unsigned i = 0;
-
-    for (i = 0; i < sequences.size(); i++) {
-	batchBases += sequences[i]->Str().length();
-	batchSeqs++;
-
-	if ((cmdArgs->BatchSize > 0) &&
-	    ((batchBases > (unsigned long)(cmdArgs->BatchSize * 1000)) ||
-	     ((cmdArgs->BatchMaxSeq > 0) &&
-	      batchSeqs >= cmdArgs->BatchMaxSeq))) {
-	    const auto batch = std::unique_ptr<Batch>(PrepareSortedBatch(
-		sequences, batchStart, i, batchBases, cmdArgs->KmerSize,
-		cmdArgs->WindowSize, cmdArgs->MinQual, qualTab, qualTabNomin));
-	    batch->BatchNr = nrBatches;
-	    batch->BatchBases = batchBases;
-	    batch->SortArgs = *cmdArgs;
-
-	    auto outFile =
-		batchDir + "/isONbatch_" + std::to_string(nrBatches) + ".cer";
-	    SaveBatch(batch, outFile);
-
-	    if (VERBOSE) {
-		cerr << "\tWritten batch " << nrBatches << " with "
-		     << (i - batchStart + 1) << " sequences and "
-		     << int((double(batchBases) / 1000.0)) << " kilobases."
-		     << endl;
-	    }
-
-	    batchBases = 0;
-	    batchSeqs = 0;
-	    batchStart = i + 1;
-	    nrBatches++;
+	cerr << "Number of batches: " << bounds.size() - 1 << endl;
+    }
+    SortedWriter writer(cmdArgs->BatchOutFolder, cmdArgs->ExportFastq);
+    BatchBuilder builder(*cmdArgs, batchDir, qualTab, qualTabNomin);
+    for (size_t b = 0; b + 1 < bounds.size(); b++) {
+	SequencesP batchSeqs;
+	batchSeqs.reserve(bounds[b + 1] - bounds[b]);
+	for (auto i = bounds[b]; i < bounds[b + 1]; i++) {
+	    writer.Add(*sequences[i]);
+	    batchSeqs.push_back(std::move(sequences[i]));
 	}
+	builder.AddBatch(std::move(batchSeqs));
     }
-
-    if (batchStart < int(sequences.size())) {
-	auto batch = std::unique_ptr<Batch>(PrepareSortedBatch(
-	    sequences, batchStart, sequences.size() - 1, batchBases,
-	    cmdArgs->KmerSize, cmdArgs->WindowSize, cmdArgs->MinQual, qualTab,
-	    qualTabNomin));
-	batch->BatchNr = nrBatches;
-	batch->BatchBases = batchBases;
-	batch->SortArgs = *cmdArgs;
-	auto outFile =
-	    batchDir + "/isONbatch_" + std::to_string(nrBatches) + ".cer";
-	SaveBatch(batch, outFile);
-
-	if (VERBOSE) {
-	    cerr << "\tWritten batch " << nrBatches << " with "
-		 << (i - batchStart + 1) << " sequences and "
-		 << int((double(batchBases) / 1000.0)) << " kilobases." << endl;
+    builder.Finish();
+    writer.Close();
+    if (VERBOSE) {
+	cerr << "Sorted sequences written to: " << writer.Store() << endl;
+	if (!writer.Fastq().empty()) {
+	    cerr << "Sorted fastq exported to: " << writer.Fastq() << endl;
 	}
+	cerr << "Scores written to: " << writer.ScoresTsv() << endl;
     }
 
     return 0;
@@ -208,13 +183,11 @@ int mainDump(int argc, char* argv[])
     if (VERBOSE) {
 	cerr << "Loading batch..." << std::endl;
     }
-    auto b = LoadBatch(cmdArgs->InCereal);
+    auto b = LoadBatch(cmdArgs->InCereal, BATCH_LOAD_CLUSTERS);
     if (VERBOSE) {
 	cerr << "Loaded batch from " << cmdArgs->InCereal << ":" << std::endl;
 	printBatchInfo(b);
     }
-    b->MinDB = MinimizerDB(0, uh);
-    b->ConsGs = ConsGraphs(0);
     CreateOutdir(cmdArgs->OutDir);
     dumpBatchInfo(b, cmdArgs->OutDir + "/batch_info.tsv");
     auto idx = LoadIndex(cmdArgs->Index);
@@ -224,7 +197,7 @@ int mainDump(int argc, char* argv[])
     if (VERBOSE) {
 	cerr << "Sorting clusters by size." << std::endl;
     }
-    if (b->Cls.size() > 0) {
+    if (!b->Cls.Empty()) {
 	SortClustersBySize(b->Cls);
 	dumpClusters(b, cmdArgs->OutDir, idx.get());
     }
@@ -252,11 +225,10 @@ int mainCluster(int argc, char* argv[])
     }
     std::unique_ptr<Batch> rightBatch;
     if (!SINGLE) {
-	rightBatch = LoadBatch(cmdArgs->RightCereal);
+	rightBatch = LoadBatch(cmdArgs->RightCereal,
+			       BATCH_LOAD_CLUSTERS | BATCH_LOAD_CONSGS);
 	cerr << "Loaded input batch from " << cmdArgs->RightCereal << ":"
 	     << std::endl;
-	rightBatch->MinDB = MinimizerDB(0, uh);
-	;
 	printBatchInfo(rightBatch);
     }
     else {
@@ -266,12 +238,12 @@ int mainCluster(int argc, char* argv[])
 	    printBatchInfo(rightBatch);
 	    cerr << "Resetting input clusters." << endl;
 	}
-	leftBatch->Cls.clear();
+	leftBatch->Cls.Clear();
 	if (leftBatch->Depth > 0) {
 	    leftBatch->Depth = -leftBatch->Depth;
 	}
 	leftBatch->NrCls = 0;
-	leftBatch->MinDB = MinimizerDB(MIN_DB_RESERVE, uh);
+	leftBatch->MinDB = MinimizerDB(MIN_DB_RESERVE);
     }
 
     if (leftBatch->SortArgs.Mode != cmdArgs->Mode) {
@@ -329,6 +301,7 @@ int mainCluster(int argc, char* argv[])
     if (cmdArgs->MinClsSize > 0) {
 	leftBatch->SortArgs.MinClsSize = cmdArgs->MinClsSize;
     }
+    leftBatch->SortArgs.MaskMins = cmdArgs->MaskMins;
     if (VERBOSE) {
 	cerr << "Clustering mode: ";
 	switch (leftBatch->SortArgs.Mode) {
@@ -348,19 +321,18 @@ int mainCluster(int argc, char* argv[])
 	}
 	cerr << endl;
     }
-    ClusterSortedReads(leftBatch, rightBatch, cmdArgs->Quiet,
-		       cmdArgs->SeqPurge);
+    ClusterSortedReads(leftBatch, rightBatch, cmdArgs->Quiet);
 
     if (VERBOSE) {
 	cerr << "Finished clustering!" << endl;
 	cerr << "Alignment invocation count: " << AlnInvoked() << " (";
-	cerr << AlnInvokedPerc(rightBatch->Cls.size()) << "%)" << endl;
+	cerr << AlnInvokedPerc(rightBatch->Cls.Size()) << "%)" << endl;
 	cerr << "Consensus invocation count: " << ConsInvoked() << " (";
-	cerr << ConsInvokedPerc(rightBatch->Cls.size()) << "%)" << endl;
+	cerr << ConsInvokedPerc(rightBatch->Cls.Size()) << "%)" << endl;
 
 	unsigned count{};
-	for (auto& c : leftBatch->Cls) {
-	    if (c->size() > 1) {
+	for (unsigned c = 0; c < leftBatch->Cls.Size(); c++) {
+	    if (leftBatch->Cls.NrMembers(c) > 0) {
 		count++;
 	    }
 	}
@@ -372,7 +344,7 @@ int mainCluster(int argc, char* argv[])
     leftBatch->RightLeaf = cmdArgs->RightCereal;
     if (cmdArgs->MinPurge) {
 	cerr << "Purging minimizer database in output batch!" << endl;
-	leftBatch->MinDB = MinimizerDB(0, uh);
+	leftBatch->MinDB = MinimizerDB();
     }
     SaveBatch(leftBatch, cmdArgs->OutCereal);
     if (VERBOSE) {
@@ -392,62 +364,83 @@ int mainInfo(int argc, char* argv[])
 	print_help_info();
 	exit(0);
     }
-    auto b = LoadBatch(target);
+    // Only the header, metadata and summary sections are read.
+    BatchFile file(target);
+    Batch b;
+    file.LoadMeta(b);
     cerr << "Loaded batch from " << target << ":" << std::endl;
-    printBatchInfo(b);
+    printBatchSummary(b, file.Summary());
+    cerr << "\tFile size: " << file.FileSize() << endl;
+    cerr << "\tCompression ratio: " << file.CompressionRatio() << endl;
     return 0;
 }
 
 void printBatchInfo(BatchP& b)
 {
-    cerr << "\tBatch number: " << b->BatchNr << endl;
-    cerr << "\tBatch range: [" << b->BatchStart << "," << b->BatchEnd << "]"
+    // The Batch counters also check the cluster state.
+    BatchSummary s = SummarizeBatch(*b);
+    s.NrClusters = b->NrClusters();
+    s.NrNontrivialClusters = b->NrNontrivialClusters();
+    printBatchSummary(*b, s);
+}
+
+void printBatchSummary(const Batch& b, const BatchSummary& s)
+{
+    cerr << "\tBatch number: " << b.BatchNr << endl;
+    cerr << "\tBatch range: [" << b.BatchStart << "," << b.BatchEnd << "]"
 	 << endl;
-    cerr << "\tDepth: " << b->Depth << endl;
-    cerr << "\tNr sequences: " << b->BatchEnd - b->BatchStart + 1 << endl;
-    cerr << "\tNr bases: " << b->BatchBases << endl;
-    cerr << "\tNr clusters: " << b->NrClusters() << endl;
-    cerr << "\tNr nontrivial clusters: " << b->NrNontrivialClusters() << endl;
-    cerr << "\tMinimizers in database: " << b->MinDBSize() << endl;
+    cerr << "\tDepth: " << b.Depth << endl;
+    cerr << "\tNr sequences: " << b.BatchEnd - b.BatchStart + 1 << endl;
+    cerr << "\tNr bases: " << b.BatchBases << endl;
+    cerr << "\tNr clusters: " << s.NrClusters << endl;
+    cerr << "\tNr nontrivial clusters: " << s.NrNontrivialClusters << endl;
+    cerr << "\tMinimizers in database: " << s.MinDBSize << endl;
 }
 
 void dumpBatchInfo(BatchP& b, std::string outfile)
 {
-    std::ofstream out;
+    OutBuffer out;
     CreateFile(outfile, out);
-    out << "Name\tValue" << endl;
-    out << "BatchNumber\t" << b->BatchNr << endl;
-    out << "BatchStart\t" << b->BatchStart << endl;
-    out << "BatchEnd\t" << b->BatchEnd << endl;
-    out << "Depth\t" << b->Depth << endl;
-    out << "NrBases\t" << b->BatchBases << endl;
-    out << "NrClusters\t" << b->NrClusters() << endl;
-    out << "NrNontrivialCls\t" << b->NrNontrivialClusters() << endl;
-    out << "MinDBsize\t" << b->MinDBSize() << endl;
-    out.close();
+    out << "Name\tValue\n";
+    out << "BatchNumber\t" << b->BatchNr << '\n';
+    out << "BatchStart\t" << b->BatchStart << '\n';
+    out << "BatchEnd\t" << b->BatchEnd << '\n';
+    out << "Depth\t" << b->Depth << '\n';
+    out << "NrBases\t" << b->BatchBases << '\n';
+    out << "NrClusters\t" << b->NrClusters() << '\n';
+    out << "NrNontrivialCls\t" << b->NrNontrivialClusters() << '\n';
+    out << "MinDBsize\t" << b->MinDBSize() << '\n';
+    out.Close();
 }
 
 void dumpClusters(BatchP& b, std::string outdir, SortedIdx* idx)
 {
-    std::ofstream outInfo;
+    OutBuffer outInfo;
     std::string outfile = outdir + "/clusters_info.tsv";
     std::string clsdir = outdir + "/cluster_fastq";
     CreateFile(outfile, outInfo);
     CreateOutdir(clsdir);
     IdMap idToCls;
-    outInfo << "ClusterId\tSize" << endl;
-    unsigned i = 0;
-    for (auto& c : b->Cls) {
-	outInfo << i << "\t" << c->size() - 1 << endl;
-	for (auto& cc : (*c)) {
+    auto& cls = b->Cls;
+    outInfo << "ClusterId\tSize\n";
+    for (unsigned i = 0; i < cls.Size(); i++) {
+	outInfo << i << '\t' << cls.NrMembers(i) << '\n';
+	// Sorted batches have representatives only.
+	auto& rep = cls.Rep(i);
+	if (rep != nullptr) {
 	    auto info = std::unique_ptr<IdInfo>(new IdInfo);
 	    info->Cls = i;
-	    info->Strand = cc->MatchStrand;
-	    idToCls[cc->Id] = std::move(info);
+	    info->Strand = rep->MatchStrand;
+	    idToCls[rep->Id] = std::move(info);
 	}
-	i++;
     }
-    outInfo.close();
+    for (unsigned long long m = 0; m < cls.NrMembers(); m++) {
+	auto info = std::unique_ptr<IdInfo>(new IdInfo);
+	info->Cls = cls.MemberCluster(m);
+	info->Strand = cls.MemberStrand(m);
+	idToCls[cls.MemberId(m)] = std::move(info);
+    }
+    outInfo.Close();
     b->MinDB = MinimizerDB(0);
     WriteClusters(b, outdir, idx, idToCls);
 }
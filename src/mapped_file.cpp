@@ -0,0 +1,37 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+
+MappedFile::MappedFile(const std::string& path) : path(path)
+{
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+	std::cerr << "Failed to open " + path + "!" << std::endl;
+	exit(1);
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size = size_t(info.st_size);
+    if (size == 0) {
+	close(fd);
+	return;
+    }
+    auto m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+	std::cerr << "Failed to map " + path + "!" << std::endl;
+	exit(1);
+    }
+    data = static_cast<const char*>(m);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr) {
+	munmap(const_cast<char*>(data), size);
+    }
+}
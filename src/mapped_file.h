@@ -0,0 +1,25 @@
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <stddef.h>
+#include <string>
+
+/// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    const std::string& Path() const { return path; }
+
+private:
+    std::string path;
+    const char* data{nullptr};
+    size_t size{0};
+};
+
+#endif
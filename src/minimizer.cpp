@@ -1,11 +1,11 @@
 #include "minimizer.h"
 
 #include <algorithm>
-#include <deque>
 #include <iostream>
 #include <numeric>
 #include <set>
 #include <string>
+#include <string.h>
 #include <unordered_set>
 
 #include "kmer_index.h"
@@ -28,45 +28,135 @@ bool operator==(const Minimizer& a, const Minimizer& b)
     return true;
 }
 
-void AddMinimizers(const Minimizers& mins, unsigned cls, MinimizerDB& db)
+PostingCounts::PostingCounts(const MinimizerDB& db)
+{
+    db.ForEach(
+	[this](unsigned, const PostingList& p) { Update(0, p.size()); });
+}
+
+void PostingCounts::Update(size_t oldLen, size_t newLen)
+{
+    if (oldLen == newLen) {
+	return;
+    }
+    if (newLen >= byLen.size()) {
+	byLen.resize(std::max(newLen + 1, 2 * byLen.size()), 0);
+    }
+    if (oldLen > 0) {
+	byLen[oldLen]--;
+	nrKeys--;
+    }
+    if (newLen > 0) {
+	byLen[newLen]++;
+	nrKeys++;
+    }
+    nrUpdates++;
+}
+
+unsigned PostingCounts::Cutoff(double mask)
+{
+    if (mask <= 0.0) {
+	return 0;
+    }
+    if (mask >= 1.0) {
+	return unsigned(mask);
+    }
+    // The quantile moves slowly, so it is only recomputed after the
+    // database changed by a percent or so.
+    if (mask == cachedMask && nrUpdates * 100 < nrKeys) {
+	return cutoff;
+    }
+    cachedMask = mask;
+    nrUpdates = 0;
+    auto skip = size_t(mask * double(nrKeys));
+    size_t skipped = 0;
+    auto len = byLen.size();
+    while (len > MASK_MIN_POSTINGS + 1 && skipped + byLen[len - 1] <= skip) {
+	skipped += byLen[--len];
+    }
+    cutoff = len > 0 ? unsigned(len - 1) : 0;
+    return cutoff;
+}
+
+void AddMinimizers(const Minimizers& mins, unsigned cls, MinimizerDB& db,
+		   PostingCounts* counts)
 {
     for (const auto& m : mins) {
-	auto v = db.find(m.Min);
-	if (v == db.end()) {
-	    db[m.Min] = RepSet{cls};
+	auto posting = MinPosting(cls, m);
+	auto reps = db.Find(m.Min);
+	auto oldLen = reps.size();
+	if (reps.size() == 0 || posting > reps.back()) {
+	    db.Append(m.Min, posting);
 	}
-	else if (v->second.size() == 0 || cls > v->second.back()) {
-	    v->second.emplace_back(cls);
+	// A canonical k-mer can occur in both orientations in a cluster.
+	else if (MinStrand(m) != 0 && posting + 1 == reps.back() &&
+		 (posting & 1) == 0 &&
+		 (reps.size() < 2 || reps[reps.size() - 2] != posting)) {
+	    db.Insert(m.Min, posting);
+	}
+	if (counts != nullptr) {
+	    counts->Update(oldLen, db.Find(m.Min).size());
 	}
     }
 }
 
 MinimizerHits GetMinimizerHits(const Minimizers& mins,
-			       const Minimizers& revMins, const MinimizerDB& db)
+			       const Minimizers& revMins, const MinimizerDB& db,
+			       Arena* arena, unsigned maxPostings)
 {
-    RawMinimizerHits hits;
-    MinimizerHits res(20 * (mins.size() + revMins.size()), sch);
+    RawMinimizerHits hits{ArenaAllocator<MinHitPair>(arena)};
+    RawMinimizerHits flipped{ArenaAllocator<MinHitPair>(arena)};
+    MinimizerHits res(20 * (mins.size() + revMins.size()), sch,
+		      std::equal_to<StrandedCluster>(),
+		      MinimizerHits::allocator_type(arena));
 
     hits.reserve(20 * mins.size());
 
-    for (auto& m : mins) {
-	auto it = db.find(m.Min);
-	if (it != db.end()) {
-	    for (auto& cls : it->second) {
-		hits.emplace_back(
-		    MinHitPair{cls, MinimizerHit{m.Pos, m.Index}});
+    // Fetch slots a few minimizers ahead, most lookups miss the cache.
+    for (size_t i = 0; i < mins.size() && i < MIN_DB_PREFETCH; i++) {
+	db.Prefetch(mins[i].Min);
+    }
+    for (size_t i = 0; i < mins.size(); i++) {
+	auto& m = mins[i];
+	if (i + MIN_DB_PREFETCH < mins.size()) {
+	    db.Prefetch(mins[i + MIN_DB_PREFETCH].Min);
+	}
+	auto postings = db.Find(m.Min);
+	if (postings.empty() ||
+	    (maxPostings > 0 && postings.size() > maxPostings)) {
+	    continue;
+	}
+	auto strand = MinStrand(m);
+	auto hit = MinimizerHit{m.Pos, MinIndex(m)};
+	for (auto posting : postings) {
+	    if (strand == 0) {
+		hits.emplace_back(MinHitPair{posting, hit});
+	    }
+	    else if (bool(posting & 1) == (strand < 0)) {
+		hits.emplace_back(MinHitPair{posting >> 1, hit});
+	    }
+	    else {
+		flipped.emplace_back(MinHitPair{posting >> 1, hit});
 	    }
 	}
     }
     ConsolidateMinimizerHits(hits, res, 1);
+    ConsolidateMinimizerHits(flipped, res, -1);
 
     hits.clear();
-    for (auto& rm : revMins) {
-	auto it = db.find(rm.Min);
-	if (it != db.end()) {
-	    for (auto& cls : it->second) {
+    for (size_t i = 0; i < revMins.size() && i < MIN_DB_PREFETCH; i++) {
+	db.Prefetch(revMins[i].Min);
+    }
+    for (size_t i = 0; i < revMins.size(); i++) {
+	auto& rm = revMins[i];
+	if (i + MIN_DB_PREFETCH < revMins.size()) {
+	    db.Prefetch(revMins[i + MIN_DB_PREFETCH].Min);
+	}
+	auto postings = db.Find(rm.Min);
+	if (maxPostings == 0 || postings.size() <= maxPostings) {
+	    for (auto cls : postings) {
 		hits.emplace_back(
-		    MinHitPair{cls, MinimizerHit{rm.Pos, rm.Index}});
+		    MinHitPair{cls, MinimizerHit{rm.Pos, MinIndex(rm)}});
 	    }
 	}
     }
@@ -75,65 +165,265 @@ MinimizerHits GetMinimizerHits(const Minimizers& mins,
     return res;
 }
 
+// Minima of the k-mers with their positions, as kmer << 32 | pos so that
+// the smaller key is the leftmost minimum. For blocks of w k-mers pre
+// holds the minimum from the block start and suf the one to the block
+// end, so any window of w k-mers is the minimum of a suffix and a prefix.
+typedef std::vector<uint64_t, ArenaAllocator<uint64_t>> MinKeys;
+static void blockMinima(const KmerSeq& kmerSeq, size_t w, MinKeys& pre,
+			MinKeys& suf)
+{
+    auto size = kmerSeq.size();
+    pre.resize(size);
+    suf.resize(size);
+    auto key = [&kmerSeq](size_t i) {
+	return (uint64_t(kmerSeq[i]) << 32) | uint64_t(i);
+    };
+    for (size_t start = 0; start < size; start += w) {
+	auto end = std::min(start + w, size);
+	pre[start] = key(start);
+	for (auto i = start + 1; i < end; i++) {
+	    pre[i] = std::min(pre[i - 1], key(i));
+	}
+	suf[end - 1] = key(end - 1);
+	for (auto i = end - 1; i > start; i--) {
+	    suf[i - 1] = std::min(suf[i], key(i - 1));
+	}
+    }
+}
+
+// A new minimizer is taken when the value of the minimum leaves the
+// window, or when a smaller k-mer enters it. The minimum of the window is
+// found in constant time from the block minima, so the whole scan is
+// linear however often the minimum leaves.
 Minimizers GetKmerMinimizers(const KmerSeq& kmerSeq, int kmerSize,
 			     int windowSize)
 {
     Minimizers minimizers;
+    if (kmerSeq.empty()) {
+	return minimizers;
+    }
 
-    int initW = windowSize - kmerSize;
-    minimizers.reserve(kmerSeq.size() - initW);
+    int size = int(kmerSeq.size());
+    int initW = std::min(windowSize - kmerSize, size - 1);
+    minimizers.reserve(size - initW);
 
     unsigned index{0};
 
-    std::deque<unsigned> windowKmers;
-    for (int i = 0; i <= initW; i++) {
-	windowKmers.push_back(kmerSeq[i]);
-    }
+    // Scratch space from the arena of the k-mers, if they have one.
+    MinKeys pre{ArenaAllocator<uint64_t>(kmerSeq.get_allocator())};
+    MinKeys suf{ArenaAllocator<uint64_t>(kmerSeq.get_allocator())};
+    size_t w = size_t(initW) + 1;
+    blockMinima(kmerSeq, w, pre, suf);
+    // Minimum of the window starting at l.
+    auto windowMin = [&](size_t l) {
+	return (l % w == 0) ? suf[l] : std::min(suf[l], pre[l + w - 1]);
+    };
 
-    auto currIt = std::min_element(windowKmers.begin(), windowKmers.end());
-    auto currMin = *currIt;
-    unsigned pos = std::distance(windowKmers.begin(), currIt);
-    auto min = Minimizer{currMin, pos, index};
-    minimizers.push_back(min);
+    auto m = windowMin(0);
+    auto currMin = unsigned(m >> 32);
+    minimizers.push_back(Minimizer{currMin, unsigned(m), index});
     index++;
 
-    for (int i = initW + 1; i < (int)kmerSeq.size(); i++) {
-	const auto& newKmer = kmerSeq[i];
-	const auto& oldKmer = windowKmers.front();
-	windowKmers.pop_front();
-	windowKmers.push_back(newKmer);
+    for (int i = initW + 1; i < size; i++) {
+	const auto newKmer = kmerSeq[i];
+	const auto oldKmer = kmerSeq[i - initW - 1];
 
 	if (currMin == oldKmer) {
-	    currIt = std::min_element(windowKmers.begin(), windowKmers.end());
-	    pos = std::distance(windowKmers.begin(), currIt) + i - initW;
-	    currMin = *currIt;
-	    min = Minimizer{currMin, pos, index};
-	    minimizers.push_back(min);
+	    m = windowMin(size_t(i - initW));
+	    currMin = unsigned(m >> 32);
+	    minimizers.push_back(Minimizer{currMin, unsigned(m), index});
 	    index++;
 	}
 	else if (newKmer < currMin) {
 	    currMin = newKmer;
-	    min = Minimizer{newKmer, (unsigned)i, index};
-	    minimizers.push_back(min);
+	    minimizers.push_back(Minimizer{newKmer, unsigned(i), index});
 	    index++;
 	}
     }
 
     return minimizers;
 }
+
+static void hashKmers(KmerSeq& kmers, int kmerSize, bool hashOrder)
+{
+    if (hashOrder) {
+	for (auto& k : kmers) {
+	    k = HashKmer(k, kmerSize);
+	}
+    }
+}
+
+void SeqMinimizers(const Seq& hpcSeq, int kmerSize, int windowSize,
+		   bool canonical, bool hashOrder, Minimizers& mins,
+		   Minimizers& revMins, Arena* arena)
+{
+    if (!canonical) {
+	auto& packed = hpcSeq.Packed();
+	auto kmers = KmerEncodeSeq(packed, kmerSize, arena);
+	hashKmers(kmers, kmerSize, hashOrder);
+	mins = GetKmerMinimizers(kmers, kmerSize, windowSize);
+	auto revKmers = KmerEncodeRevComp(packed, kmerSize, arena);
+	hashKmers(revKmers, kmerSize, hashOrder);
+	revMins = GetKmerMinimizers(revKmers, kmerSize, windowSize);
+	return;
+    }
+    KmerStrands strands{ArenaAllocator<int8_t>(arena)};
+    // The orientation is picked on the codes, so that it does not depend
+    // on the ordering.
+    auto kmers =
+	KmerEncodeCanonical(hpcSeq.Packed(), kmerSize, strands, arena);
+    hashKmers(kmers, kmerSize, hashOrder);
+    mins = GetKmerMinimizers(kmers, kmerSize, windowSize);
+    for (auto& m : mins) {
+	SetMinStrand(m, strands[m.Pos]);
+    }
+    revMins.clear();
+}
+
+static unsigned minBits(int kmerSize)
+{
+    return (kmerSize > 0 && kmerSize < 16) ? unsigned(2 * kmerSize) : 32;
+}
+
+void EncodeMinimizers(const Minimizers& mins, int kmerSize, std::string& out)
+{
+    auto bits = minBits(kmerSize);
+    bool stranded = !mins.empty() && MinStrand(mins[0]) != 0;
+    bool packed = true;
+    for (unsigned i = 0; i < mins.size() && packed; i++) {
+	auto& m = mins[i];
+	packed = (MinIndex(m) == i) && (i == 0 || m.Pos >= mins[i - 1].Pos) &&
+		 (bits == 32 || (m.Min >> bits) == 0) &&
+		 ((MinStrand(m) != 0) == stranded);
+    }
+    if (!packed) {
+	out.push_back(char(MINS_RAW));
+	out.append(reinterpret_cast<const char*>(mins.data()),
+		   mins.size() * sizeof(Minimizer));
+	return;
+    }
+
+    out.push_back(char(stranded ? MINS_PACKED_STRANDED : MINS_PACKED));
+    out.push_back(char(bits));
+    unsigned last = 0;
+    for (auto& m : mins) {
+	auto d = m.Pos - last;
+	last = m.Pos;
+	while (d >= 0x80) {
+	    out.push_back(char(0x80 | (d & 0x7f)));
+	    d >>= 7;
+	}
+	out.push_back(char(d));
+    }
+
+    std::string packedMins((mins.size() * bits + 7) / 8, 0);
+    for (size_t i = 0; i < mins.size(); i++) {
+	uint64_t v = mins[i].Min;
+	auto bit = i * bits;
+	for (unsigned b = 0; b < bits; b += 8 - (bit + b) % 8) {
+	    auto byte = (bit + b) / 8;
+	    auto shift = (bit + b) % 8;
+	    packedMins[byte] |= char((v >> b) << shift);
+	}
+    }
+    out.append(packedMins);
+
+    if (stranded) {
+	std::string strandBits((mins.size() + 7) / 8, 0);
+	for (size_t i = 0; i < mins.size(); i++) {
+	    if (MinStrand(mins[i]) < 0) {
+		strandBits[i / 8] |= char(1 << (i % 8));
+	    }
+	}
+	out.append(strandBits);
+    }
+}
+
+const char* DecodeMinimizers(const char* data, const char* end, size_t nr,
+			     Minimizers& out)
+{
+    out.resize(nr);
+    if (data >= end) {
+	return nr == 0 ? data : nullptr;
+    }
+    auto format = *data++;
+    if (format == MINS_RAW) {
+	if (size_t(end - data) < nr * sizeof(Minimizer)) {
+	    return nullptr;
+	}
+	memcpy(out.data(), data, nr * sizeof(Minimizer));
+	return data + nr * sizeof(Minimizer);
+    }
+    if ((format != MINS_PACKED && format != MINS_PACKED_STRANDED) ||
+	data == end) {
+	return nullptr;
+    }
+    unsigned bits = uint8_t(*data++);
+    if (bits == 0 || bits > 32) {
+	return nullptr;
+    }
+
+    unsigned pos = 0;
+    for (size_t i = 0; i < nr; i++) {
+	unsigned d = 0;
+	unsigned shift = 0;
+	uint8_t c;
+	do {
+	    if (data == end || shift > 28) {
+		return nullptr;
+	    }
+	    c = uint8_t(*data++);
+	    d |= unsigned(c & 0x7f) << shift;
+	    shift += 7;
+	} while (c & 0x80);
+	pos += d;
+	out[i].Pos = pos;
+	out[i].Index = unsigned(i);
+    }
+
+    auto len = (nr * bits + 7) / 8;
+    if (size_t(end - data) < len) {
+	return nullptr;
+    }
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    for (size_t i = 0; i < nr; i++) {
+	auto bit = i * bits;
+	auto byte = bit / 8;
+	// A 2k-bit value spans at most five bytes from any bit offset.
+	uint64_t w = 0;
+	memcpy(&w, data + byte, std::min(size_t(8), len - byte));
+	out[i].Min = unsigned((w >> (bit % 8)) & mask);
+    }
+    data += len;
+
+    if (format == MINS_PACKED_STRANDED) {
+	if (size_t(end - data) < (nr + 7) / 8) {
+	    return nullptr;
+	}
+	for (size_t i = 0; i < nr; i++) {
+	    SetMinStrand(out[i], ((data[i / 8] >> (i % 8)) & 1) ? -1 : 1);
+	}
+	data += (nr + 7) / 8;
+    }
+    return data;
+}
+
 void UpdateMinDB(int best, const Minimizers& oldMins, const Minimizers& newMins,
-		 MinimizerDB& db)
+		 MinimizerDB& db, PostingCounts* counts)
 {
-    std::set<unsigned> oldSet;
-    std::set<unsigned> newSet;
-    std::set<unsigned> toIns;
-    std::set<unsigned> toDel;
+    // Minimizers paired with the posting of the cluster.
+    typedef std::pair<unsigned, unsigned> MinPost;
+    std::set<MinPost> oldSet;
+    std::set<MinPost> newSet;
+    std::set<MinPost> toIns;
+    std::set<MinPost> toDel;
 
     for (auto& m : oldMins) {
-	oldSet.insert(m.Min);
+	oldSet.insert(MinPost{m.Min, MinPosting(best, m)});
     }
     for (auto& m : newMins) {
-	newSet.insert(m.Min);
+	newSet.insert(MinPost{m.Min, MinPosting(best, m)});
     }
 
     std::set_difference(oldSet.begin(), oldSet.end(), newSet.begin(),
@@ -141,20 +431,20 @@ void UpdateMinDB(int best, const Minimizers& oldMins, const Minimizers& newMins,
     std::set_difference(newSet.begin(), newSet.end(), oldSet.begin(),
 			oldSet.end(), std::inserter(toIns, toIns.begin()));
 
+    // Keys stay in the database when their lists become empty.
     for (auto m : toDel) {
-	auto& mins = db[m];
-	std::set<unsigned> tmp(mins.begin(), mins.end());
-	tmp.erase(best);
-	mins.clear();
-	mins.insert(mins.begin(), tmp.begin(), tmp.end());
-	// if (tmp.size() == 0) {
-	//    db.erase(m);
-	//}
+	auto oldLen = db.Find(m.first).size();
+	db.Erase(m.first, m.second);
+	if (counts != nullptr) {
+	    counts->Update(oldLen, db.Find(m.first).size());
+	}
     }
 
     for (auto m : toIns) {
-	auto& tv = db[m];
-	tv.push_back(best);
-	std::sort(tv.begin(), tv.end());
+	db.Insert(m.first, m.second);
+	if (counts != nullptr) {
+	    auto len = db.Find(m.first).size();
+	    counts->Update(len - 1, len);
+	}
     }
 }
@@ -1,6 +1,7 @@
 #ifndef MINIMIZER_H_INCLUDED
 #define MINIMIZER_H_INCLUDED
 
+#include <stdint.h>
 #include <map>
 #include <memory>
 #include <string>
@@ -9,14 +10,22 @@
 #include <unordered_set>
 #include <utility>
 #include <vector>
+#include "arena.h"
 #include "kmer_index.h"
+#include "minimizer_db.h"
 #include "tbb/concurrent_vector.h"
 
 #define MIN_DB_RESERVE 1000000
 #define MIN_SET_RESERVE 100
+#define MASK_MIN_POSTINGS 10
+#define MIN_DB_PREFETCH 8
 
 class Seq;
 
+/// Index is the number of the minimizer in its read. A canonical minimizer
+/// is the smaller of a k-mer and its reverse complement, it has
+/// MIN_CANONICAL set in Index, and MIN_REVERSE if that was the reverse
+/// complement. Read them with MinIndex and MinStrand.
 typedef struct {
     unsigned Min;
     unsigned Pos;
@@ -28,18 +37,71 @@ typedef struct {
     }
 } Minimizer;
 
+#define MIN_CANONICAL 0x80000000u
+#define MIN_REVERSE 0x40000000u
+#define MIN_INDEX_MASK 0x3fffffffu
+
+inline unsigned MinIndex(const Minimizer& m)
+{
+    return m.Index & MIN_INDEX_MASK;
+}
+/// 0 for a plain minimizer, for a canonical one -1 if it was the reverse
+/// complement and 1 otherwise.
+inline int MinStrand(const Minimizer& m)
+{
+    return (m.Index & MIN_CANONICAL) == 0 ? 0
+	   : (m.Index & MIN_REVERSE) != 0 ? -1 : 1;
+}
+inline void SetMinStrand(Minimizer& m, int strand)
+{
+    m.Index = MinIndex(m) | (strand == 0 ? 0 : MIN_CANONICAL) |
+	      (strand < 0 ? MIN_REVERSE : 0);
+}
+
 typedef std::vector<Minimizer> Minimizers;
 bool operator==(const Minimizer& a, const Minimizer& b);
 
 Minimizers GetKmerMinimizers(const KmerSeq& kmerSeq, int kmerSize,
 			     int windowSize);
+/// Invertible hash of a k-mer code onto its 2k bits (hash64 of minimap2).
+/// Ordering minimizers by it spreads them evenly over the k-mers, while
+/// the code order favours low complexity k-mers such as ACACA.
+inline unsigned HashKmer(unsigned kmer, int kmerSize)
+{
+    uint64_t mask = kmerSize >= 16 ? 0xffffffffull
+				   : (uint64_t(1) << (2 * kmerSize)) - 1;
+    uint64_t key = kmer & mask;
+    key = (~key + (key << 21)) & mask;
+    key = key ^ key >> 24;
+    key = ((key + (key << 3)) + (key << 8)) & mask;
+    key = key ^ key >> 14;
+    key = ((key + (key << 2)) + (key << 4)) & mask;
+    key = key ^ key >> 28;
+    key = (key + (key << 31)) & mask;
+    return unsigned(key);
+}
 
-struct UnsignedHash {
-    inline std::size_t operator()(const unsigned& u) const
-    {
-	return std::size_t(u);
-    }
-};
+/// Minimizers of an HPC sequence: forward and reverse complement ones, or
+/// with canonical set canonical ones only, leaving revMins empty. With
+/// hashOrder set minimizers are picked, and stored, as HashKmer values.
+void SeqMinimizers(const Seq& hpcSeq, int kmerSize, int windowSize,
+		   bool canonical, bool hashOrder, Minimizers& mins,
+		   Minimizers& revMins, Arena* arena = nullptr);
+
+#define MINS_RAW 0
+#define MINS_PACKED 1
+#define MINS_PACKED_STRANDED 2
+
+/// Compact encoding of a minimizer array: a format byte, then either the
+/// raw array, or the k-mer bit width, the positions as varint deltas and
+/// the k-mers packed at 2k bits. The packed format needs Index to be the
+/// array position and the positions to be ascending, as GetKmerMinimizers
+/// gives. Canonical minimizers add a bit per minimizer set for MinStrand -1.
+void EncodeMinimizers(const Minimizers& mins, int kmerSize, std::string& out);
+/// Decode nr minimizers from data, returns the end of the encoding or
+/// nullptr if it overruns end.
+const char* DecodeMinimizers(const char* data, const char* end, size_t nr,
+			     Minimizers& out);
 
 // From: https://www.variadic.xyz/2018/01/15/hashing-stdpair-and-stdtuple/
 template <typename T>
@@ -57,9 +119,41 @@ struct StrandedClsHash {
     }
 };
 
-typedef std::vector<unsigned> RepSet;
-typedef std::unordered_map<unsigned, RepSet, UnsignedHash> MinimizerDB;
-void AddMinimizers(const Minimizers& mins, unsigned cls, MinimizerDB& db);
+/// Entry of cluster cls in the posting list of m. For canonical minimizers
+/// it is 2 * cls, plus one if the cluster has the k-mer reverse complemented.
+inline unsigned MinPosting(unsigned cls, const Minimizer& m)
+{
+    auto strand = MinStrand(m);
+    return strand == 0 ? cls : 2 * cls + unsigned(strand < 0);
+}
+
+/// Number of minimizers of a MinimizerDB by the length of their posting
+/// list, kept up to date by AddMinimizers and UpdateMinDB so that the
+/// masking cutoff of frequent minimizers follows the database.
+class PostingCounts {
+public:
+    PostingCounts() = default;
+    explicit PostingCounts(const MinimizerDB& db);
+    /// Record that a posting list went from oldLen to newLen entries.
+    void Update(size_t oldLen, size_t newLen);
+    /// Minimizers with a non-empty posting list.
+    size_t NrKeys() const { return nrKeys; }
+    /// Longest posting list kept by GetMinimizerHits, 0 for no limit. A mask
+    /// of at least 1 is the cutoff itself, a smaller one the fraction of the
+    /// minimizers with the longest lists to skip, never cutting lists of up
+    /// to MASK_MIN_POSTINGS entries.
+    unsigned Cutoff(double mask);
+
+private:
+    std::vector<size_t> byLen;
+    size_t nrKeys{0};
+    size_t nrUpdates{0};
+    double cachedMask{-1.0};
+    unsigned cutoff{0};
+};
+
+void AddMinimizers(const Minimizers& mins, unsigned cls, MinimizerDB& db,
+		   PostingCounts* counts = nullptr);
 typedef struct {
     unsigned Pos;
     unsigned Index;
@@ -70,14 +164,23 @@ typedef struct {
     MinimizerHit Hits;
 } MinHitPair;
 
-typedef std::vector<MinimizerHit> MinimizerHitVector;
-typedef std::vector<MinHitPair> RawMinimizerHits;
-typedef std::unordered_map<StrandedCluster, MinimizerHitVector, StrandedClsHash>
+// The hits of a query live in its Arena, if it has one.
+typedef std::vector<MinimizerHit, ArenaAllocator<MinimizerHit>>
+    MinimizerHitVector;
+typedef std::vector<MinHitPair, ArenaAllocator<MinHitPair>> RawMinimizerHits;
+typedef std::unordered_map<
+    StrandedCluster, MinimizerHitVector, StrandedClsHash,
+    std::equal_to<StrandedCluster>,
+    ArenaAllocator<std::pair<const StrandedCluster, MinimizerHitVector>>>
     MinimizerHits;
 
+/// Hits of a read on the clusters of db. Hits of canonical minimizers go
+/// to the strand given by the orientation of the k-mer in read and cluster.
+/// Minimizers with more than maxPostings clusters are skipped, unless it
+/// is 0.
 MinimizerHits GetMinimizerHits(const Minimizers& mins,
-			       const Minimizers& revMins,
-			       const MinimizerDB& db);
+			       const Minimizers& revMins, const MinimizerDB& db,
+			       Arena* arena = nullptr, unsigned maxPostings = 0);
 void ConsolidateMinimizerHits(const RawMinimizerHits& hits, MinimizerHits& res,
 			      int strand);
 
@@ -90,6 +193,6 @@ typedef std::unique_ptr<SortedHit> SortedHitP;
 
 typedef std::vector<SortedHitP> SortedHits;
 void UpdateMinDB(int best, const Minimizers& oldMins, const Minimizers& newMins,
-		 MinimizerDB& db);
+		 MinimizerDB& db, PostingCounts* counts = nullptr);
 
 #endif
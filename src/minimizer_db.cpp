@@ -0,0 +1,246 @@
+#include "minimizer_db.h"
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+static size_t pow2Above(size_t n)
+{
+    size_t p = 1;
+    while (p < n) {
+	p *= 2;
+    }
+    return p;
+}
+
+static unsigned log2Of(unsigned p)
+{
+    unsigned l = 0;
+    while ((1u << l) < p) {
+	l++;
+    }
+    return l;
+}
+
+MinimizerDB::MinimizerDB(size_t nrKeys) { Reserve(nrKeys); }
+
+void MinimizerDB::Clear()
+{
+    slots.clear();
+    mask = 0;
+    shift = 64;
+    nrKeys = 0;
+    chunks.clear();
+    chunkUsed = 0;
+    freeBlocks.clear();
+}
+
+void MinimizerDB::Reserve(size_t n)
+{
+    // Slots are kept at most 80% full.
+    auto nrSlots =
+	pow2Above(std::max(size_t(MINDB_MIN_SLOTS), n + n / 4 + 1));
+    if (n > 0 && nrSlots > slots.size()) {
+	rehash(nrSlots);
+    }
+}
+
+size_t MinimizerDB::MemoryUsage() const
+{
+    auto bytes = slots.capacity() * sizeof(Slot);
+    for (auto& c : chunks) {
+	bytes += c.capacity() * sizeof(unsigned);
+    }
+    return bytes;
+}
+
+void MinimizerDB::rehash(size_t nrSlots)
+{
+    std::vector<Slot> old(nrSlots);
+    old.swap(slots);
+    for (auto& s : slots) {
+	s.Len = emptySlot;
+    }
+    mask = nrSlots - 1;
+    shift = 64 - log2Of(unsigned(nrSlots));
+    for (auto& s : old) {
+	if (s.Len != emptySlot) {
+	    place(s);
+	}
+    }
+}
+
+size_t MinimizerDB::place(Slot s)
+{
+    auto i = home(s.Key);
+    size_t dist = 0;
+    size_t res = slots.size();
+    while (true) {
+	auto& cur = slots[i];
+	if (cur.Len == emptySlot) {
+	    cur = s;
+	    return res == slots.size() ? i : res;
+	}
+	// Take the slot of a key closer to its home, and carry that on.
+	auto curDist = (i - home(cur.Key)) & mask;
+	if (curDist < dist) {
+	    std::swap(cur, s);
+	    if (res == slots.size()) {
+		res = i;
+	    }
+	    dist = curDist;
+	}
+	i = (i + 1) & mask;
+	dist++;
+    }
+}
+
+MinimizerDB::Slot& MinimizerDB::slotFor(unsigned key)
+{
+    auto s = findSlot(key);
+    if (s != nullptr) {
+	return const_cast<Slot&>(*s);
+    }
+    if (5 * (nrKeys + 1) > 4 * slots.size()) {
+	rehash(std::max(size_t(MINDB_MIN_SLOTS), 2 * slots.size()));
+    }
+    nrKeys++;
+    Slot n;
+    n.Key = key;
+    n.Len = 0;
+    return slots[place(n)];
+}
+
+unsigned MinimizerDB::allocBlock(unsigned capacity)
+{
+    auto l = log2Of(capacity);
+    if (l < freeBlocks.size() && !freeBlocks[l].empty()) {
+	auto off = freeBlocks[l].back();
+	freeBlocks[l].pop_back();
+	return off;
+    }
+    const unsigned chunkSize = 1u << MINDB_CHUNK_BITS;
+    auto nrChunks = std::max(capacity / chunkSize, 1u);
+    if (chunks.empty() || capacity > chunkSize - chunkUsed) {
+	// The rest of the last chunk goes to the free blocks.
+	auto rest = chunks.empty() ? 0 : chunkSize - chunkUsed;
+	while (rest >= 2 * MINDB_INLINE) {
+	    auto size = 1u << (log2Of(rest + 1) - 1);
+	    freeBlock(unsigned(chunks.size() - 1) << MINDB_CHUNK_BITS |
+			  chunkUsed,
+		      size);
+	    chunkUsed += size;
+	    rest -= size;
+	}
+	if (chunks.size() + nrChunks > (size_t(1) << (32 - MINDB_CHUNK_BITS))) {
+	    std::cerr << "Minimizer database overflow: too many postings!"
+		      << std::endl;
+	    exit(1);
+	}
+	chunks.emplace_back(std::max(capacity, chunkSize));
+	chunks.resize(chunks.size() + nrChunks - 1);
+	chunkUsed = 0;
+    }
+    auto off = unsigned(chunks.size() - nrChunks) << MINDB_CHUNK_BITS |
+	       chunkUsed;
+    chunkUsed = nrChunks > 1 ? chunkSize : chunkUsed + capacity;
+    return off;
+}
+
+void MinimizerDB::freeBlock(unsigned offset, unsigned capacity)
+{
+    auto l = log2Of(capacity);
+    if (l >= freeBlocks.size()) {
+	freeBlocks.resize(l + 1);
+    }
+    freeBlocks[l].push_back(offset);
+}
+
+// Make room for len postings, keeping the first ones. The caller sets Len.
+void MinimizerDB::resize(Slot& s, unsigned len)
+{
+    if (len <= MINDB_INLINE) {
+	if (s.Len > MINDB_INLINE) {
+	    auto off = s.Data[0];
+	    auto capacity = s.Data[1];
+	    memcpy(s.Data, block(off), len * sizeof(unsigned));
+	    freeBlock(off, capacity);
+	}
+	return;
+    }
+    if (s.Len <= MINDB_INLINE) {
+	auto capacity =
+	    unsigned(pow2Above(std::max(unsigned(2 * MINDB_INLINE), len)));
+	auto off = allocBlock(capacity);
+	memcpy(block(off), s.Data, s.Len * sizeof(unsigned));
+	s.Data[0] = off;
+	s.Data[1] = capacity;
+	return;
+    }
+    if (len > s.Data[1]) {
+	auto capacity = unsigned(pow2Above(len));
+	auto off = allocBlock(capacity);
+	memcpy(block(off), block(s.Data[0]), s.Len * sizeof(unsigned));
+	freeBlock(s.Data[0], s.Data[1]);
+	s.Data[0] = off;
+	s.Data[1] = capacity;
+    }
+}
+
+void MinimizerDB::Append(unsigned key, unsigned posting)
+{
+    auto& s = slotFor(key);
+    auto len = s.Len;
+    resize(s, len + 1);
+    s.Len = len + 1;
+    postings(s)[len] = posting;
+}
+
+void MinimizerDB::Insert(unsigned key, unsigned posting)
+{
+    auto& s = slotFor(key);
+    auto len = s.Len;
+    resize(s, len + 1);
+    s.Len = len + 1;
+    auto p = postings(s);
+    auto pos = std::upper_bound(p, p + len, posting);
+    memmove(pos + 1, pos, size_t(p + len - pos) * sizeof(unsigned));
+    *pos = posting;
+}
+
+void MinimizerDB::Erase(unsigned key, unsigned posting)
+{
+    auto found = findSlot(key);
+    if (found == nullptr) {
+	return;
+    }
+    auto& s = const_cast<Slot&>(*found);
+    auto p = postings(s);
+    auto len = unsigned(std::remove(p, p + s.Len, posting) - p);
+    resize(s, len);
+    s.Len = len;
+}
+
+void MinimizerDB::Assign(unsigned key, const unsigned* data, size_t len)
+{
+    auto& s = slotFor(key);
+    resize(s, unsigned(len));
+    s.Len = unsigned(len);
+    std::copy(data, data + len, postings(s));
+}
+
+bool operator==(const MinimizerDB& a, const MinimizerDB& b)
+{
+    if (a.Size() != b.Size()) {
+	return false;
+    }
+    bool same = true;
+    a.ForEach([&](unsigned key, const PostingList& p) {
+	auto q = b.Find(key);
+	if (!b.Contains(key) || p.size() != q.size() ||
+	    !std::equal(p.begin(), p.end(), q.begin())) {
+	    same = false;
+	}
+    });
+    return same;
+}
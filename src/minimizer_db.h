@@ -0,0 +1,190 @@
+#ifndef MINIMIZER_DB_H_INCLUDED
+#define MINIMIZER_DB_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define MINDB_INLINE 2
+#define MINDB_MIN_SLOTS 16
+#define MINDB_CHUNK_BITS 20
+
+/// Postings of a minimizer, a view into a MinimizerDB that is valid until
+/// the database is modified.
+class PostingList {
+public:
+    PostingList() = default;
+    PostingList(const unsigned* data, unsigned len) : ptr(data), len(len) {}
+
+    const unsigned* begin() const { return ptr; }
+    const unsigned* end() const { return ptr + len; }
+    const unsigned* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    unsigned operator[](size_t i) const { return ptr[i]; }
+    unsigned back() const { return ptr[len - 1]; }
+
+private:
+    const unsigned* ptr{nullptr};
+    unsigned len{0};
+};
+
+/// Posting lists of minimizers in an open addressing table with Robin Hood
+/// probing. A slot holds the key and up to MINDB_INLINE postings, so most
+/// lookups touch a single cache line. Longer lists live in overflow chunks
+/// of 2^MINDB_CHUNK_BITS postings, in blocks of power of two sizes, and a
+/// block given up by a growing list is reused by the next list of that
+/// size. Lists longer than a chunk get chunks of their own. Keys are never
+/// removed, but their lists can become empty.
+class MinimizerDB {
+public:
+    explicit MinimizerDB(size_t nrKeys = 0);
+
+    size_t Size() const { return nrKeys; }
+    bool Empty() const { return nrKeys == 0; }
+    void Clear();
+    void Reserve(size_t nrKeys);
+    /// Bytes held by the table and the overflow chunks.
+    size_t MemoryUsage() const;
+
+    bool Contains(unsigned key) const { return findSlot(key) != nullptr; }
+    /// Postings of key, empty if it is missing.
+    PostingList Find(unsigned key) const
+    {
+	auto s = findSlot(key);
+	return s == nullptr ? PostingList() : PostingList(postings(*s), s->Len);
+    }
+    /// Fetch the slot of key into the cache ahead of a Find.
+    void Prefetch(unsigned key) const
+    {
+	if (!slots.empty()) {
+	    __builtin_prefetch(&slots[home(key)]);
+	}
+    }
+
+    /// Append a posting to the list of key, adding the key if missing.
+    void Append(unsigned key, unsigned posting);
+    /// Insert a posting into the sorted list of key, after equal ones.
+    void Insert(unsigned key, unsigned posting);
+    /// Remove a posting from the list of key.
+    void Erase(unsigned key, unsigned posting);
+    /// Replace the list of key.
+    void Assign(unsigned key, const unsigned* data, size_t len);
+
+    /// Call f(key, postings) for every key, in table order.
+    template <typename F>
+    void ForEach(F f) const
+    {
+	for (auto& s : slots) {
+	    if (s.Len != emptySlot) {
+		f(s.Key, PostingList(postings(s), s.Len));
+	    }
+	}
+    }
+
+    template <class Archive>
+    void save(Archive& archive) const
+    {
+	std::vector<unsigned> keys;
+	std::vector<unsigned> lens;
+	std::vector<unsigned> all;
+	ForEach([&](unsigned key, const PostingList& p) {
+	    keys.push_back(key);
+	    lens.push_back(unsigned(p.size()));
+	    all.insert(all.end(), p.begin(), p.end());
+	});
+	archive(keys, lens, all);
+    }
+    template <class Archive>
+    void load(Archive& archive)
+    {
+	std::vector<unsigned> keys;
+	std::vector<unsigned> lens;
+	std::vector<unsigned> all;
+	archive(keys, lens, all);
+	Clear();
+	Reserve(keys.size());
+	size_t off = 0;
+	for (size_t i = 0; i < keys.size(); i++) {
+	    Assign(keys[i], all.data() + off, lens[i]);
+	    off += lens[i];
+	}
+    }
+
+private:
+    static const unsigned emptySlot = 0xffffffffu;
+
+    // Data holds the postings of short lists, or the offset and the
+    // capacity of the block of a long one. The offset is the chunk number
+    // followed by MINDB_CHUNK_BITS bits of position in the chunk.
+    typedef struct {
+	unsigned Key;
+	unsigned Len;
+	unsigned Data[MINDB_INLINE];
+    } Slot;
+
+    size_t home(unsigned key) const
+    {
+	return size_t((uint64_t(key) * 0x9e3779b97f4a7c15ull) >> shift);
+    }
+    const Slot* findSlot(unsigned key) const
+    {
+	if (slots.empty()) {
+	    return nullptr;
+	}
+	auto i = home(key);
+	for (size_t dist = 0;; dist++) {
+	    auto& s = slots[i];
+	    if (s.Len == emptySlot) {
+		return nullptr;
+	    }
+	    if (s.Key == key) {
+		return &s;
+	    }
+	    // Robin Hood order: the key would have displaced this one.
+	    if (((i - home(s.Key)) & mask) < dist) {
+		return nullptr;
+	    }
+	    i = (i + 1) & mask;
+	}
+    }
+    Slot& slotFor(unsigned key);
+    size_t place(Slot s);
+    void rehash(size_t nrSlots);
+
+    const unsigned* block(unsigned off) const
+    {
+	return chunks[off >> MINDB_CHUNK_BITS].data() +
+	       (off & ((1u << MINDB_CHUNK_BITS) - 1));
+    }
+    unsigned* block(unsigned off)
+    {
+	return chunks[off >> MINDB_CHUNK_BITS].data() +
+	       (off & ((1u << MINDB_CHUNK_BITS) - 1));
+    }
+    const unsigned* postings(const Slot& s) const
+    {
+	return s.Len <= MINDB_INLINE ? s.Data : block(s.Data[0]);
+    }
+    unsigned* postings(Slot& s)
+    {
+	return s.Len <= MINDB_INLINE ? s.Data : block(s.Data[0]);
+    }
+    void resize(Slot& s, unsigned len);
+    unsigned allocBlock(unsigned capacity);
+    void freeBlock(unsigned offset, unsigned capacity);
+
+    std::vector<Slot> slots;
+    size_t mask{0};
+    unsigned shift{64};
+    size_t nrKeys{0};
+    // Chunks taken by a long list after its first one are left empty.
+    std::vector<std::vector<unsigned>> chunks;
+    unsigned chunkUsed{0};
+    // Offsets of unused blocks by log2 of their capacity.
+    std::vector<std::vector<unsigned>> freeBlocks;
+};
+
+bool operator==(const MinimizerDB& a, const MinimizerDB& b);
+
+#endif
@@ -0,0 +1,149 @@
+#include "out_buffer.h"
+
+#include <string.h>
+#include <iostream>
+
+OutBuffer::~OutBuffer() { Close(); }
+
+void OutBuffer::Open(const std::string& outFile, bool async)
+{
+    Close();
+    fh = fopen(outFile.c_str(), "w");
+    if (fh == nullptr) {
+	std::cerr << "Failed to open " + outFile + "!" << std::endl;
+	exit(1);
+    }
+    path = outFile;
+    this->async = async;
+    done = false;
+    if (async) {
+	worker = std::thread(&OutBuffer::flushLoop, this);
+    }
+}
+
+void OutBuffer::Write(const char* data, size_t len)
+{
+    buf.append(data, len);
+    if (buf.size() >= OUT_BUFFER_SIZE) {
+	handOff();
+    }
+}
+
+OutBuffer& OutBuffer::operator<<(const char* s)
+{
+    Write(s, strlen(s));
+    return *this;
+}
+
+OutBuffer& OutBuffer::operator<<(double v)
+{
+    char tmp[32];
+    auto len = snprintf(tmp, sizeof(tmp), "%g", v);
+    Write(tmp, size_t(len));
+    return *this;
+}
+
+OutBuffer& OutBuffer::writeSigned(long long v)
+{
+    if (v < 0) {
+	Write("-", 1);
+	return writeUnsigned(0ULL - (unsigned long long)(v));
+    }
+    return writeUnsigned((unsigned long long)(v));
+}
+
+OutBuffer& OutBuffer::writeUnsigned(unsigned long long v)
+{
+    char tmp[24];
+    auto p = tmp + sizeof(tmp);
+    do {
+	*--p = char('0' + v % 10);
+	v /= 10;
+    } while (v > 0);
+    Write(p, size_t(tmp + sizeof(tmp) - p));
+    return *this;
+}
+
+// Pass the buffer to the background thread, or write it out directly.
+void OutBuffer::handOff()
+{
+    if (buf.empty()) {
+	return;
+    }
+    if (!async) {
+	writeOut(buf);
+	buf.clear();
+	return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return queue.size() < OUT_QUEUE_SIZE; });
+    queue.push_back(std::move(buf));
+    cv.notify_all();
+    lock.unlock();
+    buf = std::string();
+    buf.reserve(OUT_BUFFER_SIZE);
+}
+
+void OutBuffer::writeOut(const std::string& data)
+{
+    if (fwrite(data.data(), 1, data.size(), fh) != data.size()) {
+	std::cerr << "Failed to write " + path + "!" << std::endl;
+	exit(1);
+    }
+}
+
+void OutBuffer::flushLoop()
+{
+    while (true) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return !queue.empty() || done; });
+	if (queue.empty()) {
+	    return;
+	}
+	auto data = std::move(queue.front());
+	queue.pop_front();
+	writing = true;
+	cv.notify_all();
+	lock.unlock();
+
+	writeOut(data);
+
+	lock.lock();
+	writing = false;
+	cv.notify_all();
+    }
+}
+
+void OutBuffer::Flush()
+{
+    if (fh == nullptr) {
+	return;
+    }
+    handOff();
+    if (async) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return queue.empty() && !writing; });
+    }
+    fflush(fh);
+}
+
+void OutBuffer::Close()
+{
+    if (fh == nullptr) {
+	return;
+    }
+    handOff();
+    if (async) {
+	{
+	    std::lock_guard<std::mutex> lock(mtx);
+	    done = true;
+	}
+	cv.notify_all();
+	worker.join();
+    }
+    if (fclose(fh) != 0) {
+	std::cerr << "Failed to write " + path + "!" << std::endl;
+	exit(1);
+    }
+    fh = nullptr;
+}
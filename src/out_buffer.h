@@ -0,0 +1,71 @@
+#ifndef OUT_BUFFER_H_INCLUDED
+#define OUT_BUFFER_H_INCLUDED
+
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define OUT_BUFFER_SIZE (8 * 1024 * 1024)
+#define OUT_QUEUE_SIZE 4
+
+/// Buffered text output file. Data is collected in a large buffer which
+/// is written out whole, by a background thread in async mode. Nothing is
+/// flushed line by line.
+class OutBuffer {
+public:
+    OutBuffer() = default;
+    OutBuffer(const OutBuffer&) = delete;
+    OutBuffer& operator=(const OutBuffer&) = delete;
+    ~OutBuffer();
+
+    void Open(const std::string& outFile, bool async = false);
+    void Write(const char* data, size_t len);
+    /// Hand the buffered data to the file, waiting for the background
+    /// thread to write it.
+    void Flush();
+    void Close();
+    bool IsOpen() const { return fh != nullptr; }
+
+    OutBuffer& operator<<(const std::string& s)
+    {
+	Write(s.data(), s.size());
+	return *this;
+    }
+    OutBuffer& operator<<(const char* s);
+    OutBuffer& operator<<(char c)
+    {
+	Write(&c, 1);
+	return *this;
+    }
+    OutBuffer& operator<<(int v) { return writeSigned(v); }
+    OutBuffer& operator<<(long v) { return writeSigned(v); }
+    OutBuffer& operator<<(long long v) { return writeSigned(v); }
+    OutBuffer& operator<<(unsigned v) { return writeUnsigned(v); }
+    OutBuffer& operator<<(unsigned long v) { return writeUnsigned(v); }
+    OutBuffer& operator<<(unsigned long long v) { return writeUnsigned(v); }
+    /// Formatted like std::ostream with the default precision.
+    OutBuffer& operator<<(double v);
+
+private:
+    OutBuffer& writeSigned(long long v);
+    OutBuffer& writeUnsigned(unsigned long long v);
+    void handOff();
+    void writeOut(const std::string& data);
+    void flushLoop();
+
+    FILE* fh{nullptr};
+    std::string path;
+    std::string buf;
+    bool async{false};
+    std::thread worker;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::string> queue;
+    bool writing{false};
+    bool done{false};
+};
+
+#endif
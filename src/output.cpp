@@ -27,39 +27,49 @@ int dirExists(const std::string path)
 	return 0;
 }
 
-void SequencesPToFastq(SequencesP& sequences, const std::string& outFastq,
-		       const std::string& indexTab, const std::string& indexCer)
+SortedWriter::SortedWriter(const std::string& outFolder, bool exportFastq)
+    : outFolder(outFolder),
+      store(outFolder + "/sorted_reads.isrs"),
+      scoresTsv(outFolder + "/scores.tsv"),
+      storeWriter(store)
 {
-    std::ofstream outfile;
-    std::ofstream outTsv;
-    CreateFile(outFastq, outfile);
-    CreateFile(indexTab, outTsv);
-    outTsv << "Id\tPos" << std::endl;
-    unsigned long long int seeker = 0;
-    SortedIdx idx;
-    idx.Fastq = outFastq;
+    if (exportFastq) {
+	fastq = outFolder + "/sorted_reads.fastq";
+	CreateFile(fastq, outFastq, true);
+	CreateFile(outFolder + "/sorted_reads_idx.tsv", outTsv);
+	outTsv << "Id\tPos\n";
+    }
+    CreateFile(scoresTsv, outScores);
+}
 
-    for (auto& s : sequences) {
-	if (s->Score() < 0) {
-	    continue;
-	}
-	outTsv << s->Name() << "\t" << seeker << std::endl;
-	seeker += WriteFastqRecord(*s, outfile);
+void SortedWriter::Add(const Seq& s)
+{
+    storeWriter.Add(s);
+    if (s.Score() >= 0 && outFastq.IsOpen()) {
+	outTsv << s.Name() << '\t' << seeker << '\n';
+	seeker += WriteFastqRecord(s, outFastq);
     }
-    outfile.close();
-    outTsv.close();
-    std::ofstream os(indexCer, std::ios::binary);
+    outScores << s.Name() << '\t' << s.Score() << '\n';
+}
+
+void SortedWriter::Close()
+{
+    storeWriter.Close();
+    outFastq.Close();
+    outTsv.Close();
+    outScores.Close();
+
+    SortedIdx idx;
+    idx.Fastq = fastq;
+    idx.Store = store;
+    std::ofstream os(outFolder + "/sorted_reads_idx.cer", std::ios::binary);
     cereal::BinaryOutputArchive archive(os);
     archive(idx);
 }
 
-void CreateFile(const std::string& outFile, std::ofstream& outfile)
+void CreateFile(const std::string& outFile, OutBuffer& outfile, bool async)
 {
-    outfile.open(outFile);
-    if (!outfile.is_open()) {
-	std::cerr << "Failed to open " + outFile + "!" << std::endl;
-	exit(1);
-    }
+    outfile.Open(outFile, async);
 }
 
 void OpenFile(const std::string& inFile, std::ifstream& infile)
@@ -71,24 +81,13 @@ void OpenFile(const std::string& inFile, std::ifstream& infile)
     }
 }
 
-unsigned WriteFastqRecord(const Seq& s, std::ofstream& out)
+unsigned WriteFastqRecord(const Seq& s, OutBuffer& out)
 {
-    out << "@" << s.Name() << std::endl;
-    out << s.Str() << std::endl;
-    out << "+" << std::endl;
-    out << s.Qual() << std::endl;
-    return (s.Name().length() + s.Str().length() + s.Qual().length() + 6);
-}
-
-void WriteScores(SequencesP& sequences, const std::string& outFile)
-{
-    std::ofstream outfile;
-    CreateFile(outFile, outfile);
-
-    for (auto& s : sequences) {
-	outfile << s->Name() << "\t" << s->Score() << std::endl;
-    }
-    outfile.close();
+    out << '@' << s.Name() << '\n';
+    out << s.Str() << '\n';
+    out << "+\n";
+    out << s.Qual() << '\n';
+    return (s.Name().length() + s.Len() + s.Quals().Len() + 6);
 }
 
 std::unique_ptr<SortedIdx> LoadIndex(std::string inf)
@@ -125,59 +124,46 @@ void CreateOutdir(const std::string& outDir)
 
 typedef std::unique_ptr<FqRec> FqRecP;
 
-FqRecP GetRecords(std::ifstream& infq)
-{
-    FqRecP rec(new FqRec);
-    std::getline(infq, rec->Header);
-    if (infq.eof()) {
-	return nullptr;
-    }
-    std::getline(infq, rec->Seq);
-    std::getline(infq, rec->Plus);
-    std::getline(infq, rec->Qual);
-    auto ididx = rec->Header.find(" ");
-    rec->Id = rec->Header.substr(1, ididx);
-    return rec;
-}
-
-void WriteFqRec(FqRecP& r, std::ofstream& fh)
+void WriteFqRec(FqRecP& r, OutBuffer& fh)
 {
-    fh << r->Header << std::endl;
-    fh << r->Seq << std::endl;
-    fh << r->Plus << std::endl;
-    fh << r->Qual << std::endl;
+    fh << r->Header << '\n';
+    fh << r->Seq << '\n';
+    fh << r->Plus << '\n';
+    fh << r->Qual << '\n';
 }
 
 void WriteClusters(BatchP& b, const std::string& outDir, SortedIdx* idx,
 		   IdMap& idToCls)
 {
-    std::ofstream outfile;
-    std::ofstream outfq;
-    std::ofstream outcons;
-    std::ifstream infq;
-    OpenFile(idx->Fastq, infq);
+    OutBuffer outfile;
+    OutBuffer outcons;
+    if (idx->Store.empty()) {
+	std::cerr << "No read store in the index, please rerun sort!"
+		  << std::endl;
+	exit(1);
+    }
+    ReadStore store(idx->Store);
     std::string outFile = outDir + "/clusters.tsv";
     std::string outCons = outDir + "/cluster_cons.fq";
-    CreateFile(outFile, outfile);
+    CreateFile(outFile, outfile, true);
     CreateFile(outCons, outcons);
 
-    outfile << "ClusterId\tStrand\tRead" << std::endl;
+    outfile << "ClusterId\tStrand\tRead\n";
     if (VERBOSE) {
 	std::cerr << "Writing out cluster information:" << std::endl;
     }
 
     auto& cls = b->Cls;
-    for (unsigned i = 0; i < cls.size(); i++) {
+    for (unsigned i = 0; i < cls.Size(); i++) {
 	if (VERBOSE) {
-	    Pbar((float)(i + 1) / float(cls.size()));
+	    Pbar((float)(i + 1) / float(cls.Size()));
 	}
-	auto reads = cls[i];
-	if (reads == nullptr) {
+	auto& read = cls.Rep(i);
+	if (read == nullptr) {
 	    std::cerr << "Null pointer instead of cluster rep at index: " << i
 		      << std::endl;
 	    exit(1);
 	}
-	auto read = reads->at(0);
 	if (read->RawSeq == nullptr) {
 	    std::cerr << "Null pointer instead of cluster rep sequence "
 			 "at index: "
@@ -188,24 +174,31 @@ void WriteClusters(BatchP& b, const std::string& outDir, SortedIdx* idx,
 	if (s->Score() < 0) {
 	    continue;
 	}
-	auto seq = std::string(read->RawSeq->Str());
-	auto qual = std::string(read->RawSeq->Qual());
+	auto seq = read->RawSeq->Str();
+	auto repQual = s->Qual();
+	if (s->Quals().Kind() == QualNone) {
+	    // Dropped after sort, so the representative is still the read.
+	    repQual = store.Get(read->Id)->Qual();
+	}
+	auto qual = repQual;
 	if (read->MatchStrand == -1) {
-	    seq = RevComp(seq);
+	    RevCompInPlace(seq);
 	    std::reverse(qual.begin(), qual.end());
 	}
-	outcons << "@cluster_" << i << " origin=" << s->Name() << ":"
+	// Only representatives made while clustering keep a name.
+	auto origin = (s->Name().empty() ? store.Name(read->Id) : s->Name());
+	outcons << "@cluster_" << i << " origin=" << origin << ":"
 		<< read->MatchStrand << " length=" << seq.length()
-		<< " size=" << cls[i]->size() - 1 << std::endl;
-	outcons << seq << std::endl;
-	outcons << "+" << std::endl;
-	outcons << s->Qual() << std::endl;  // FIXME
+		<< " size=" << cls.NrMembers(i) << '\n';
+	outcons << seq << '\n';
+	outcons << "+\n";
+	outcons << repQual << '\n';  // FIXME
     }
-    outcons.close();
+    outcons.Close();
     if (VERBOSE) {
 	std::cerr << std::endl;
     }
-    b->Cls = Clusters();
+    b->Cls.Clear();
 
     SeqCache seqCache;
 
@@ -214,7 +207,16 @@ void WriteClusters(BatchP& b, const std::string& outDir, SortedIdx* idx,
     }
     unsigned j = 0;
     unsigned jj = 0;
-    for (auto rec = GetRecords(infq); rec != nullptr; rec = GetRecords(infq)) {
+    // Reads that did not pass scoring are not written out.
+    for (unsigned long long ord = 0; ord < store.NrReads(); ord++) {
+	auto v = idToCls.find(ord);
+	if (v == idToCls.end()) {
+	    continue;
+	}
+	auto s = store.Get(ord);
+	if (s->Score() < 0) {
+	    continue;
+	}
 	if (VERBOSE) {
 	    auto now = ((float)(j + 1) / float(idToCls.size()));
 	    if (unsigned(now) > jj || j == 0) {
@@ -222,23 +224,25 @@ void WriteClusters(BatchP& b, const std::string& outDir, SortedIdx* idx,
 		jj = unsigned(now);
 	    }
 	}
-	auto readId = rec->Header.substr(1, rec->Header.size());
-	auto v = idToCls.find(readId);
-	if (v == idToCls.end()) {
-	    continue;
-	}
+	FqRecP rec(new FqRec);
+	rec->Id = s->Name();
+	rec->Header = "@" + s->Name();
+	rec->Seq = s->Str();
+	rec->Plus = "+";
+	rec->Qual = s->Qual();
+	auto& readId = rec->Id;
 
 	if (v->second->Strand == -1) {
-	    rec->Seq = RevComp(rec->Seq);
+	    RevCompInPlace(rec->Seq);
 	    std::reverse(rec->Qual.begin(), rec->Qual.end());
 	}
 
-	outfile << v->second->Cls << "\t" << v->second->Strand << "\t" << readId
-		<< std::endl;
+	outfile << v->second->Cls << '\t' << v->second->Strand << '\t' << readId
+		<< '\n';
 	seqCache[v->second->Cls].push_back(std::move(rec));
 	j++;
     }
-    outfile.close();
+    outfile.Close();
     if (VERBOSE) {
 	std::cerr << std::endl;
     }
@@ -258,14 +262,13 @@ void WriteClusters(BatchP& b, const std::string& outDir, SortedIdx* idx,
 		kk = unsigned(now);
 	    }
 	}
-	std::ofstream outfq;
+	OutBuffer outfq;
 	CreateFile(outDir + "/cluster_fastq/" + std::to_string(c.first) + ".fq",
 		   outfq);
 	for (auto& r : c.second) {
 	    WriteFqRec(r, outfq);
 	}
-	outfq.flush();
-	outfq.close();
+	outfq.Close();
 	k++;
     }
 
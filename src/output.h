@@ -4,10 +4,14 @@
 #include <stdlib.h>
 #include <cereal/archives/binary.hpp>
 #include <cereal/cereal.hpp>
+#include <fstream>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include "cluster.h"
+#include "out_buffer.h"
 #include "pbar.h"
+#include "read_store.h"
 #include "seq.h"
 
 #include "serialize.h"
@@ -15,26 +19,50 @@
 typedef struct {
 public:
     std::string Fastq{};
+    std::string Store{};
     template <class Archive>
     void serialize(Archive& archive)
     {
-	archive(Fastq);
+	archive(Fastq, Store);
     };
 } SortedIdx;
 
-void SequencesPToFastq(SequencesP& sequences, const std::string& outFastq,
-		       const std::string& indexTab,
-		       const std::string& indexCer);
+/// Writes all sorted reads to the read store and the score table, one read
+/// at a time. The reads that passed scoring can also be exported as fastq
+/// with an index of byte offsets.
+class SortedWriter {
+public:
+    SortedWriter(const std::string& outFolder, bool exportFastq = false);
+    void Add(const Seq& s);
+    void Close();
+    const std::string& Store() const { return store; }
+    /// Empty unless the fastq is exported.
+    const std::string& Fastq() const { return fastq; }
+    const std::string& ScoresTsv() const { return scoresTsv; }
+
+private:
+    std::string outFolder;
+    std::string store;
+    std::string fastq;
+    std::string scoresTsv;
+    ReadStoreWriter storeWriter;
+    OutBuffer outFastq;
+    OutBuffer outTsv;
+    OutBuffer outScores;
+    unsigned long long seeker{0};
+};
+
 void CreateOutdir(const std::string& outDir);
-unsigned WriteFastqRecord(const Seq& s, std::ofstream& out);
-void CreateFile(const std::string& outFile, std::ofstream& outfile);
+unsigned WriteFastqRecord(const Seq& s, OutBuffer& out);
+void CreateFile(const std::string& outFile, OutBuffer& outfile,
+		bool async = false);
 void OpenFile(const std::string& inFile, std::ofstream& infile);
-void WriteScores(SequencesP& sequences, const std::string& outFile);
 typedef struct {
     unsigned Cls;
     int Strand;
 } IdInfo;
-typedef std::unordered_map<std::string, std::unique_ptr<IdInfo>> IdMap;
+/// Cluster and strand of the reads, by read ordinal.
+typedef std::unordered_map<unsigned long long, std::unique_ptr<IdInfo>> IdMap;
 
 typedef struct {
     std::string Id;
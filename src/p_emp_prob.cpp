@@ -19,11 +19,11 @@ bool operator<(const ErrTarget& a, const ErrTarget& b)
     return false;
 }
 
-MinSharedMap InitMinSharedMap(int kmerSize, int windowSize)
+MinSharedMap InitMinSharedMap(int kmerSize, int windowSize, bool hashOrder)
 {
     MinSharedMap res;
 
-    std::istringstream tokenStream(pMinText);
+    std::istringstream tokenStream(hashOrder ? pMinHashText : pMinText);
     std::string ts;
 
     while (getline(tokenStream, ts, '\n')) {
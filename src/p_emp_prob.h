@@ -14,7 +14,17 @@ struct ErrTarget {
 typedef std::map<ErrTarget, double> MinSharedMap;
 
 bool operator<(const ErrTarget& a, const ErrTarget& b);
-MinSharedMap InitMinSharedMap(int kmerSize, int windowSize);
+
+/// Probability tables as "k w p e1 e2" lines, for the code order and the
+/// hash order of minimizers.
+extern std::string pMinText;
+extern std::string pMinHashText;
+
+/// Empirical probabilities of a minimizer being shared by two reads with
+/// the given error rates, from the table for minimizers ordered by
+/// HashKmer if hashOrder is set.
+MinSharedMap InitMinSharedMap(int kmerSize, int windowSize,
+			      bool hashOrder = false);
 std::tuple<int, int, double, double, double> parseMinTextLine(const std::string& line);
 double GetPMinShared(double e1, double e2, const MinSharedMap& msm);
 
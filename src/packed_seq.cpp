@@ -0,0 +1,130 @@
+#include "packed_seq.h"
+
+#include <string.h>
+#include <algorithm>
+
+#define B(c) (c == 'A' ? 0 : c == 'C' ? 1 : c == 'G' ? 2 : c == 'T' ? 3 : -1)
+#define B4(c) B(c), B(c + 1), B(c + 2), B(c + 3)
+#define B16(c) B4(c), B4(c + 4), B4(c + 8), B4(c + 12)
+#define B64(c) B16(c), B16(c + 16), B16(c + 32), B16(c + 48)
+
+const int8_t BaseCodes[256] = {B64(0), B64(64), B64(128), B64(192)};
+
+#undef B64
+#undef B16
+#undef B4
+#undef B
+
+// Four unpacked bases for every byte value.
+struct unpackTable {
+    char Bases[256][4];
+    unpackTable()
+    {
+	static const char acgt[4] = {'A', 'C', 'G', 'T'};
+	for (int b = 0; b < 256; b++) {
+	    for (int i = 0; i < 4; i++) {
+		Bases[b][i] = acgt[(b >> (2 * i)) & 3];
+	    }
+	}
+    }
+};
+
+static const unpackTable unpackTab;
+
+void PackBases(const char* seq, size_t len, uint8_t* out,
+	       std::vector<uint32_t>& excPos, std::string& excBases)
+{
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+	uint8_t byte = 0;
+	for (size_t j = 0; j < 4; j++) {
+	    int c = BaseCodes[uint8_t(seq[i + j])];
+	    if (c < 0) {
+		excPos.push_back(uint32_t(i + j));
+		excBases.push_back(seq[i + j]);
+		c = 0;
+	    }
+	    byte |= uint8_t(c << (2 * j));
+	}
+	out[i / 4] = byte;
+    }
+    if (i < len) {
+	uint8_t byte = 0;
+	for (size_t j = 0; i + j < len; j++) {
+	    int c = BaseCodes[uint8_t(seq[i + j])];
+	    if (c < 0) {
+		excPos.push_back(uint32_t(i + j));
+		excBases.push_back(seq[i + j]);
+		c = 0;
+	    }
+	    byte |= uint8_t(c << (2 * j));
+	}
+	out[i / 4] = byte;
+    }
+}
+
+void UnpackBases(const uint8_t* packed, size_t len, char* out)
+{
+    size_t full = len / 4;
+    for (size_t i = 0; i < full; i++) {
+	memcpy(out + 4 * i, unpackTab.Bases[packed[i]], 4);
+    }
+    if (len % 4 > 0) {
+	memcpy(out + 4 * full, unpackTab.Bases[packed[full]], len % 4);
+    }
+}
+
+PackedSeq::PackedSeq(uint32_t len, const uint8_t* packed, const char* excPos,
+		     const char* excBases, size_t nrExc)
+    : len(len), packed(packed, packed + (size_t(len) + 3) / 4), exc(nrExc)
+{
+    for (size_t i = 0; i < nrExc; i++) {
+	memcpy(&exc[i].Pos, excPos + i * sizeof(uint32_t), sizeof(uint32_t));
+	exc[i].Base = excBases[i];
+    }
+}
+
+void PackedSeq::Assign(const char* seq, size_t len)
+{
+    this->len = uint32_t(len);
+    packed.assign((len + 3) / 4, 0);
+    std::vector<uint32_t> excPos;
+    std::string excBases;
+    PackBases(seq, len, packed.data(), excPos, excBases);
+    exc.resize(excPos.size());
+    for (size_t i = 0; i < excPos.size(); i++) {
+	exc[i].Pos = excPos[i];
+	exc[i].Base = excBases[i];
+    }
+    exc.shrink_to_fit();
+}
+
+int PackedSeq::Code(unsigned i) const
+{
+    if (!exc.empty()) {
+	auto it = std::lower_bound(
+	    exc.begin(), exc.end(), i,
+	    [](const PackedExc& e, unsigned pos) { return e.Pos < pos; });
+	if (it != exc.end() && it->Pos == i) {
+	    return -1;
+	}
+    }
+    return (packed[i / 4] >> (2 * (i % 4))) & 3;
+}
+
+void PackedSeq::UnpackTo(char* out) const
+{
+    UnpackBases(packed.data(), len, out);
+    for (auto& e : exc) {
+	out[e.Pos] = e.Base;
+    }
+}
+
+std::string PackedSeq::Unpack() const
+{
+    std::string res(len, 0);
+    if (len > 0) {
+	UnpackTo(&res[0]);
+    }
+    return res;
+}
@@ -0,0 +1,73 @@
+#ifndef PACKED_SEQ_H_INCLUDED
+#define PACKED_SEQ_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// 2-bit codes of A, C, G and T, -1 for any other character.
+extern const int8_t BaseCodes[256];
+
+/// Pack bases four to a byte (A0 C1 G2 T3, first base in the low bits).
+/// Other characters are packed as A and reported through excPos and
+/// excBases.
+void PackBases(const char* seq, size_t len, uint8_t* out,
+	       std::vector<uint32_t>& excPos, std::string& excBases);
+/// Unpack len bases, ignoring exceptions.
+void UnpackBases(const uint8_t* packed, size_t len, char* out);
+
+/// Base other than A, C, G or T.
+typedef struct {
+    uint32_t Pos;
+    char Base;
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+	archive(Pos, Base);
+    }
+} PackedExc;
+
+/// Nucleotide sequence at 2 bits per base, with a list of the positions
+/// holding N, IUPAC codes or lower case bases.
+class PackedSeq {
+public:
+    PackedSeq() = default;
+    explicit PackedSeq(const std::string& seq)
+    {
+	Assign(seq.data(), seq.size());
+    }
+    PackedSeq(const char* seq, size_t len) { Assign(seq, len); }
+    /// Copy an already packed sequence, with nrExc uint32 exception
+    /// positions (not necessarily aligned) and their bases.
+    PackedSeq(uint32_t len, const uint8_t* packed, const char* excPos,
+	      const char* excBases, size_t nrExc);
+
+    void Assign(const char* seq, size_t len);
+    unsigned Len() const { return len; }
+    bool Empty() const { return len == 0; }
+    /// 2-bit code of base i, -1 for exceptions.
+    int Code(unsigned i) const;
+    std::string Unpack() const;
+    void UnpackTo(char* out) const;
+
+    const std::vector<uint8_t>& Bytes() const { return packed; }
+    const std::vector<PackedExc>& Exceptions() const { return exc; }
+    size_t MemSize() const
+    {
+	return packed.capacity() + exc.capacity() * sizeof(PackedExc);
+    }
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+	archive(len, packed, exc);
+    }
+
+private:
+    uint32_t len{0};
+    std::vector<uint8_t> packed;
+    std::vector<PackedExc> exc;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "qual_store.h"
+
+#include <iostream>
+
+// Phred values 3b..3b+2 share bin b, and are restored as 3b+1.
+#define QUAL_BIN_WIDTH 3
+#define QUAL_NR_BINS 16
+
+static inline uint8_t qualBin(char q)
+{
+    int phred = q - 33;
+    if (phred < 0) {
+	phred = 0;
+    }
+    int bin = phred / QUAL_BIN_WIDTH;
+    return uint8_t(bin < QUAL_NR_BINS ? bin : QUAL_NR_BINS - 1);
+}
+
+static inline char binQual(uint8_t bin)
+{
+    return char(33 + QUAL_BIN_WIDTH * bin + 1);
+}
+
+QualStore::QualStore(QualKind kind, uint32_t len, std::string data)
+    : kind(kind), len(len), data(std::move(data))
+{
+    if (this->data.size() != DataSize(kind, len)) {
+	std::cerr << "Invalid quality data of kind " << int(kind) << "!"
+		  << std::endl;
+	exit(1);
+    }
+}
+
+QualStore QualStore::Const(char qual, unsigned len)
+{
+    return QualStore(QualConst, len, std::string(len > 0 ? 1 : 0, qual));
+}
+
+size_t QualStore::DataSize(QualKind kind, unsigned len)
+{
+    switch (kind) {
+	case QualFull:
+	    return len;
+	case QualConst:
+	    return (len > 0 ? 1 : 0);
+	case QualBinned:
+	    return (size_t(len) + 1) / 2;
+	default:
+	    return 0;
+    }
+}
+
+std::string QualStore::Str() const
+{
+    switch (kind) {
+	case QualFull:
+	    return data;
+	case QualConst:
+	    return std::string(len, len > 0 ? data[0] : 0);
+	case QualBinned: {
+	    std::string res(len, 0);
+	    for (unsigned i = 0; i < len; i++) {
+		res[i] = binQual((uint8_t(data[i / 2]) >> (4 * (i % 2))) & 15);
+	    }
+	    return res;
+	}
+	default:
+	    return std::string();
+    }
+}
+
+void QualStore::Bin()
+{
+    if (kind != QualFull) {
+	return;
+    }
+    std::string packed(DataSize(QualBinned, len), 0);
+    for (unsigned i = 0; i < len; i++) {
+	packed[i / 2] |= char(qualBin(data[i]) << (4 * (i % 2)));
+    }
+    data = std::move(packed);
+    kind = QualBinned;
+}
+
+void QualStore::Drop()
+{
+    data = std::string();
+    kind = QualNone;
+}
+
+void QualStore::Reduce(QualKind to)
+{
+    if (to == QualBinned) {
+	Bin();
+    }
+    else if (to == QualNone) {
+	Drop();
+    }
+}
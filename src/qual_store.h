@@ -0,0 +1,47 @@
+#ifndef QUAL_STORE_H_INCLUDED
+#define QUAL_STORE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+typedef enum { QualFull = 0, QualConst, QualBinned, QualNone } QualKind;
+
+/// Base qualities kept in full, as a single repeated value, binned to 16
+/// levels at 4 bits per base, or dropped with only their number kept.
+class QualStore {
+public:
+    QualStore() = default;
+    explicit QualStore(const std::string& qual)
+	: kind(QualFull), len(uint32_t(qual.size())), data(qual)
+    {
+    }
+    /// Restore from the stored kind, length and data.
+    QualStore(QualKind kind, uint32_t len, std::string data);
+    static QualStore Const(char qual, unsigned len);
+
+    QualKind Kind() const { return QualKind(kind); }
+    unsigned Len() const { return len; }
+    /// Quality string, empty if dropped.
+    std::string Str() const;
+    const std::string& Data() const { return data; }
+    static size_t DataSize(QualKind kind, unsigned len);
+
+    void Bin();
+    void Drop();
+    /// Convert a full quality string to the given kind.
+    void Reduce(QualKind to);
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+	archive(kind, len, data);
+    }
+
+private:
+    uint8_t kind{QualFull};
+    uint32_t len{0};
+    std::string data;
+};
+
+#endif
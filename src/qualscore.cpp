@@ -19,7 +19,7 @@ void FillQualScores(SequencesP& sequences, int kmerSize, int windowSize,
 	[&](tbb::blocked_range<int> r) {
 	    for (int i = r.begin(); i < r.end(); ++i) {
 		auto& s = sequences[i];
-		if (s->Str().length() > unsigned(2 * kmerSize)) {
+		if (s->Len() > unsigned(2 * kmerSize)) {
 		    auto qs = CalcQualScore(*s, kmerSize, qualTab);
 		    if (qs <= 0) {
 			qs = -1.0;
@@ -39,64 +39,69 @@ void FillQualScores(SequencesP& sequences, int kmerSize, int windowSize,
 Batch* PrepareSortedBatch(SequencesP& sequences, int batchStart, int batchEnd,
 			  int batchSize, int kmerSize, int windowSize,
 			  double minQual, const QualTab& qualTab,
-			  const QualTab& qualTabNomin)
+			  const QualTab& qualTabNomin,
+			  unsigned long long firstRead, QualKind batchQual,
+			  bool canonicalMins, bool hashMins)
 {
     int size = 1 + batchEnd - batchStart;
     auto batch = new Batch;
 
-    batch->Cls = Clusters(size);
+    batch->Cls.Resize(size);
     tbb::parallel_for(
 	tbb::blocked_range<int>(0, size), [&](tbb::blocked_range<int> r) {
+	    // HPC and k-mer scratch space, reused for every read of the range.
+	    Arena arena;
 	    for (int i = r.begin(); i < r.end(); ++i) {
 		auto j = batchStart + i;
 		auto& s = sequences[j];
-		if (batch->Cls[i] == nullptr) {
-		    batch->Cls[i] = make_shared<Cluster>(Cluster());
-		}
+		auto id = firstRead + j;
+		// Read names are kept in the read store only.
+		s->SetName(std::string());
 		if ((-10 * log10(s->ErrorRate())) <= minQual) {
-		    batch->Cls[i]->emplace_back(std::make_shared<ProcSeq>(
+		    batch->Cls.Rep(i) = std::make_shared<ProcSeq>(
 			ProcSeq{nullptr, nullptr, Minimizers{}, Minimizers{}, 0,
-				s->Name()}));
+				id});
 		    continue;
 		}
-		if (s->Str().length() > unsigned(2 * kmerSize) ||
-		    s->Str().length() >= unsigned(windowSize)) {
-		    auto hpcSeq = std::unique_ptr<Seq>(HomopolymerCompress(s));
-		    if (hpcSeq->Str().length() < unsigned(2 * kmerSize) ||
-			hpcSeq->Str().length() < unsigned(windowSize)) {
+		if (s->Len() > unsigned(2 * kmerSize) ||
+		    s->Len() >= unsigned(windowSize)) {
+		    arena.Reset();
+		    auto hpcSeq =
+			std::unique_ptr<Seq>(HomopolymerCompress(s, &arena));
+		    if (hpcSeq->Len() < unsigned(2 * kmerSize) ||
+			hpcSeq->Len() < unsigned(windowSize)) {
 			s->SetScore(-1.0);
 			hpcSeq->SetScore(-1.0);
-			batch->Cls[i]->emplace_back(make_shared<ProcSeq>(
+			batch->Cls.Rep(i) = make_shared<ProcSeq>(
 			    ProcSeq{nullptr, nullptr, Minimizers{},
-				    Minimizers{}, 0, s->Name()}));
+				    Minimizers{}, 0, id});
 			continue;
 		    }
-		    const auto& kmerSeq =
-			KmerEncodeSeq(hpcSeq->Str(), kmerSize);
-		    const auto& revKmerSeq =
-			KmerEncodeSeq(RevComp(hpcSeq->Str()), kmerSize);
+		    Minimizers mins;
+		    Minimizers revMins;
+		    SeqMinimizers(*hpcSeq, kmerSize, windowSize, canonicalMins,
+				  hashMins, mins, revMins, &arena);
 		    const auto& hpcErr =
 			CalcErrorRate(hpcSeq->Qual(), qualTabNomin);
 		    hpcSeq->SetErrorRate(hpcErr);
-		    auto mins =
-			GetKmerMinimizers(kmerSeq, kmerSize, windowSize);
-		    auto revMins =
-			GetKmerMinimizers(revKmerSeq, kmerSize, windowSize);
-		    auto id = sequences[j]->Name();
-		    batch->Cls[i]->emplace_back(make_shared<ProcSeq>(
+		    // Only the error rates are used after this point.
+		    s->ReduceQual(batchQual);
+		    hpcSeq->ReduceQual(batchQual);
+		    batch->Cls.Rep(i) = make_shared<ProcSeq>(
 			ProcSeq{std::move(sequences[j]), std::move(hpcSeq),
-				std::move(mins), std::move(revMins), 1, id}));
+				std::move(mins), std::move(revMins), 1, id});
 		}
 		else {
 		    s->SetScore(-1.0);
-		    batch->Cls[i]->emplace_back(make_shared<ProcSeq>(
+		    s->ReduceQual(batchQual);
+		    batch->Cls.Rep(i) = make_shared<ProcSeq>(
 			ProcSeq{std::move(s), nullptr, Minimizers{},
-				Minimizers{}, 0, s->Name()}));
+				Minimizers{}, 0, id});
 		}
 	    }
 	});
 
-    batch->NrCls = int(batch->Cls.size());
+    batch->NrCls = int(batch->Cls.Size());
     batch->BatchStart = batchStart;
     batch->BatchEnd = batchEnd;
     batch->Depth = -1;
@@ -17,7 +17,9 @@ double CalcQualScore(const Seq& s, int kmerSize, const QualTab& qualTab);
 Batch* PrepareSortedBatch(SequencesP& sequences, int batchStart, int batchEnd,
 			  int batchSize, int kmerSize, int windowSize,
 			  double minQual, const QualTab& qualTab,
-			  const QualTab& qualTabNomin);
+			  const QualTab& qualTabNomin,
+			  unsigned long long firstRead, QualKind batchQual,
+			  bool canonicalMins, bool hashMins);
 QualTab InitQualTab();
 QualTab InitQualTabNomin();
 void SortByQualScores(SequencesP& sequences);
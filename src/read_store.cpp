@@ -0,0 +1,251 @@
+#include "read_store.h"
+
+#include <string.h>
+#include <iostream>
+
+#include "tbb/parallel_for.h"
+#include "zlib.h"
+
+// Fixed size part of a record, followed by the name, the exception
+// positions and characters, the packed bases and the qualities.
+typedef struct {
+    uint32_t NameLen;
+    uint32_t SeqLen;
+    uint32_t NrExc;
+    uint32_t QualLen;
+    uint32_t QualBytes;
+    uint32_t QualRaw;
+    double Score;
+} recordHead;
+
+template <typename T>
+static inline void append(std::string& out, const T& v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+void EncodeReadRecord(const Seq& s, std::string& out)
+{
+    auto& seq = s.Packed();
+    auto qual = s.Qual();
+    recordHead h;
+    memset(&h, 0, sizeof(h));
+    h.NameLen = uint32_t(s.Name().size());
+    h.SeqLen = seq.Len();
+    h.QualLen = uint32_t(qual.size());
+    h.Score = s.Score();
+    h.NrExc = uint32_t(seq.Exceptions().size());
+
+    // Qualities are stored as they are if deflating does not help.
+    std::string comp(deflateBound(nullptr, uLong(qual.size())) + 16, 0);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(qual.data()));
+    zs.avail_in = uInt(qual.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&comp[0]);
+    zs.avail_out = uInt(comp.size());
+    auto ret = deflate(&zs, Z_FINISH);
+    comp.resize(zs.total_out);
+    deflateEnd(&zs);
+    h.QualRaw = (ret != Z_STREAM_END || comp.size() >= qual.size());
+    h.QualBytes = uint32_t(h.QualRaw ? qual.size() : comp.size());
+
+    append(out, h);
+    out.append(s.Name());
+    for (auto& e : seq.Exceptions()) {
+	append(out, e.Pos);
+    }
+    for (auto& e : seq.Exceptions()) {
+	out.push_back(e.Base);
+    }
+    out.append(reinterpret_cast<const char*>(seq.Bytes().data()),
+	       seq.Bytes().size());
+    out.append(h.QualRaw ? qual : comp);
+}
+
+std::unique_ptr<Seq> DecodeReadRecord(const char* data, size_t size)
+{
+    recordHead h;
+    if (size < sizeof(h)) {
+	std::cerr << "Corrupt read store record!" << std::endl;
+	exit(1);
+    }
+    memcpy(&h, data, sizeof(h));
+    auto packedLen = (size_t(h.SeqLen) + 3) / 4;
+    if (sizeof(h) + h.NameLen + size_t(h.NrExc) * 5 + packedLen +
+	    h.QualBytes !=
+	size) {
+	std::cerr << "Corrupt read store record!" << std::endl;
+	exit(1);
+    }
+    auto p = data + sizeof(h);
+    std::string name(p, h.NameLen);
+    p += h.NameLen;
+    auto excPos = p;
+    auto excBase = p + size_t(h.NrExc) * sizeof(uint32_t);
+    auto packed = reinterpret_cast<const unsigned char*>(excBase + h.NrExc);
+
+    PackedSeq seq(h.SeqLen, packed, excPos, excBase, h.NrExc);
+
+    auto q = reinterpret_cast<const char*>(packed + packedLen);
+    std::string qual;
+    if (h.QualRaw) {
+	qual.assign(q, h.QualBytes);
+    }
+    else {
+	qual.assign(h.QualLen, 0);
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	inflateInit2(&zs, -15);
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(q));
+	zs.avail_in = h.QualBytes;
+	zs.next_out = reinterpret_cast<Bytef*>(&qual[0]);
+	zs.avail_out = h.QualLen;
+	auto ret = inflate(&zs, Z_FINISH);
+	auto got = zs.total_out;
+	inflateEnd(&zs);
+	if (ret != Z_STREAM_END || got != h.QualLen) {
+	    std::cerr << "Corrupt qualities in read store record: " << name
+		      << std::endl;
+	    exit(1);
+	}
+    }
+
+    return std::unique_ptr<Seq>(
+	new Seq(name, std::move(seq), QualStore(qual), h.Score));
+}
+
+ReadStoreWriter::ReadStoreWriter(const std::string& storeFile)
+    : path(storeFile)
+{
+    fh = fopen(storeFile.c_str(), "wb");
+    if (fh == nullptr) {
+	std::cerr << "Failed to open " + storeFile + "!" << std::endl;
+	exit(1);
+    }
+    // The header is rewritten on Close.
+    ReadStoreHeader h;
+    memset(&h, 0, sizeof(h));
+    writeOut(&h, sizeof(h));
+}
+
+ReadStoreWriter::~ReadStoreWriter() { Close(); }
+
+void ReadStoreWriter::writeOut(const void* data, size_t len)
+{
+    if (fwrite(data, 1, len, fh) != len) {
+	std::cerr << "Failed to write " + path + "!" << std::endl;
+	exit(1);
+    }
+    pos += len;
+}
+
+void ReadStoreWriter::Add(const Seq& s)
+{
+    pending.emplace_back(new Seq(s));
+    pendingBytes += s.Len() + s.Quals().Len() + s.Name().size();
+    if (pendingBytes >= READ_STORE_BLOCK_SIZE) {
+	writeBlock();
+    }
+}
+
+void ReadStoreWriter::writeBlock()
+{
+    std::vector<std::string> records(pending.size());
+    tbb::parallel_for(size_t(0), pending.size(), [&](size_t i) {
+	EncodeReadRecord(*pending[i], records[i]);
+    });
+    for (auto& r : records) {
+	offsets.push_back(pos);
+	writeOut(r.data(), r.size());
+    }
+    pending.clear();
+    pendingBytes = 0;
+}
+
+void ReadStoreWriter::Close()
+{
+    if (fh == nullptr) {
+	return;
+    }
+    writeBlock();
+
+    ReadStoreHeader h;
+    memcpy(h.Magic, READ_STORE_MAGIC, sizeof(h.Magic));
+    h.Version = READ_STORE_VERSION;
+    h.NrReads = offsets.size();
+    h.IndexOffset = pos;
+    writeOut(offsets.data(), offsets.size() * sizeof(uint64_t));
+    if (fseek(fh, 0, SEEK_SET) != 0) {
+	std::cerr << "Failed to write " + path + "!" << std::endl;
+	exit(1);
+    }
+    writeOut(&h, sizeof(h));
+    if (fclose(fh) != 0) {
+	std::cerr << "Failed to write " + path + "!" << std::endl;
+	exit(1);
+    }
+    fh = nullptr;
+}
+
+ReadStore::ReadStore(const std::string& storeFile) : file(storeFile)
+{
+    auto size = file.Size();
+    if (size >= sizeof(header)) {
+	memcpy(&header, file.Data(), sizeof(header));
+    }
+    if (size < sizeof(header) ||
+	memcmp(header.Magic, READ_STORE_MAGIC, sizeof(header.Magic)) != 0 ||
+	header.Version != READ_STORE_VERSION ||
+	header.IndexOffset + header.NrReads * sizeof(uint64_t) != size) {
+	std::cerr << "Invalid read store: " + storeFile << std::endl;
+	exit(1);
+    }
+}
+
+const char* ReadStore::record(unsigned long long i, size_t& size) const
+{
+    if (i >= header.NrReads) {
+	std::cerr << "Read ordinal " << i << " out of range in " + file.Path()
+		  << std::endl;
+	exit(1);
+    }
+    uint64_t start, end = header.IndexOffset;
+    auto data = file.Data();
+    auto index = data + header.IndexOffset;
+    memcpy(&start, index + i * sizeof(uint64_t), sizeof(start));
+    if (i + 1 < header.NrReads) {
+	memcpy(&end, index + (i + 1) * sizeof(uint64_t), sizeof(end));
+    }
+    if (start > end || end > header.IndexOffset) {
+	std::cerr << "Corrupt read store index: " + file.Path() << std::endl;
+	exit(1);
+    }
+    size = size_t(end - start);
+    return data + start;
+}
+
+std::unique_ptr<Seq> ReadStore::Get(unsigned long long i) const
+{
+    size_t size;
+    auto data = record(i, size);
+    return DecodeReadRecord(data, size);
+}
+
+std::string ReadStore::Name(unsigned long long i) const
+{
+    size_t size;
+    auto data = record(i, size);
+    recordHead h;
+    if (size < sizeof(h)) {
+	std::cerr << "Corrupt read store record!" << std::endl;
+	exit(1);
+    }
+    memcpy(&h, data, sizeof(h));
+    if (sizeof(h) + h.NameLen > size) {
+	std::cerr << "Corrupt read store record!" << std::endl;
+	exit(1);
+    }
+    return std::string(data + sizeof(h), h.NameLen);
+}
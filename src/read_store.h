@@ -0,0 +1,75 @@
+#ifndef READ_STORE_H_INCLUDED
+#define READ_STORE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "seq.h"
+
+#define READ_STORE_MAGIC "ISRS"
+#define READ_STORE_VERSION 1
+#define READ_STORE_BLOCK_SIZE (16 * 1024 * 1024)
+
+/// Binary store of sorted reads. Records hold the name, the 2-bit packed
+/// bases with the positions of other characters, the raw deflated
+/// qualities and the score. An index of record offsets at the end of the
+/// file gives access by read ordinal.
+///
+/// Layout: header, records, index (NrReads offsets).
+typedef struct {
+    char Magic[4];
+    uint32_t Version;
+    uint64_t NrReads;
+    uint64_t IndexOffset;
+} ReadStoreHeader;
+
+/// Appends reads to a store. Records are encoded in parallel a block at a
+/// time.
+class ReadStoreWriter {
+public:
+    explicit ReadStoreWriter(const std::string& storeFile);
+    ~ReadStoreWriter();
+    void Add(const Seq& s);
+    void Close();
+    unsigned long long NrReads() const
+    {
+	return offsets.size() + pending.size();
+    }
+
+private:
+    void writeBlock();
+    void writeOut(const void* data, size_t len);
+
+    std::string path;
+    FILE* fh{nullptr};
+    SequencesP pending;
+    size_t pendingBytes{0};
+    std::vector<uint64_t> offsets;
+    uint64_t pos{0};
+};
+
+/// Memory-mapped read-only store.
+class ReadStore {
+public:
+    explicit ReadStore(const std::string& storeFile);
+    unsigned long long NrReads() const { return header.NrReads; }
+    /// Decode the read with the given ordinal.
+    std::unique_ptr<Seq> Get(unsigned long long i) const;
+    /// Name of the read with the given ordinal, without decoding the rest.
+    std::string Name(unsigned long long i) const;
+
+private:
+    const char* record(unsigned long long i, size_t& size) const;
+
+    MappedFile file;
+    ReadStoreHeader header;
+};
+
+void EncodeReadRecord(const Seq& s, std::string& out);
+std::unique_ptr<Seq> DecodeReadRecord(const char* data, size_t size);
+
+#endif
@@ -12,6 +12,8 @@
 #include "bioparser/fasta_parser.hpp"
 #include "bioparser/fastq_parser.hpp"
 #include "kmer_index.h"
+#include "packed_seq.h"
+#include "qual_store.h"
 
 class Seq;
 typedef std::vector<std::unique_ptr<Seq>> SequencesP;
@@ -21,34 +23,35 @@ class Seq {
 public:
     Seq(const std::string& name, const std::string& seq,
 	const std::string& qual, double score);
+    Seq(const std::string& name, PackedSeq seq, QualStore qual, double score);
     ~Seq() = default;
 
     const std::string& Name() const { return name; }
     void SetName(const std::string& name) { this->name = name; }
 
-    const std::string& Str() const { return seq; }
-    unsigned Len() const { return unsigned(seq.length()); }
-    void SetStr(const std::string& seq)
-    {
-	this->seq = seq;
-	this->seq.reserve(this->seq.length());
-    }
+    /// Bases are stored packed, Str unpacks them.
+    std::string Str() const { return seq.Unpack(); }
+    const PackedSeq& Packed() const { return seq; }
+    unsigned Len() const { return seq.Len(); }
+    void SetStr(const std::string& seq) { this->seq = PackedSeq(seq); }
 
-    const std::string& Qual() const { return qual; }
+    /// Quality string, empty if the qualities were dropped.
+    std::string Qual() const { return qual.Str(); }
+    const QualStore& Quals() const { return qual; }
     unsigned MeanQual() const { return unsigned(-10 * log10(errorRate)); }
     std::vector<std::uint32_t> Weights() const
     {
-	std::vector<std::uint32_t> w(qual.size(), 0);
-	for (unsigned i = 0; i < qual.size(); i++) {
-	    w[i] = std::uint32_t(qual[i] - 33);
+	auto q = qual.Str();
+	std::vector<std::uint32_t> w(q.size(), 0);
+	for (unsigned i = 0; i < q.size(); i++) {
+	    w[i] = std::uint32_t(q[i] - 33);
 	}
 	return w;
     }
-    void SetQual(const std::string& qual)
-    {
-	this->qual = qual;
-	this->qual.reserve(qual.length());
-    }
+    void SetQual(const std::string& qual) { this->qual = QualStore(qual); }
+    void SetQual(QualStore qual) { this->qual = std::move(qual); }
+    /// Keep the qualities only as the given kind once they are not needed.
+    void ReduceQual(QualKind to) { qual.Reduce(to); }
 
     double Score() const { return score; }
 
@@ -65,6 +68,7 @@ public:
 
     friend bioparser::FastaParser<Seq>;
     friend bioparser::FastqParser<Seq>;
+    friend class FastqReader;
     Seq(const Seq& o)
     {
 	name = o.name;
@@ -79,8 +83,8 @@ public:
     const Seq& operator=(const Seq& t)
     {
 	name = std::string(t.name);
-	seq = std::string(t.seq);
-	qual = std::string(t.qual);
+	seq = t.seq;
+	qual = t.qual;
 	score = t.score;
 	errorRate = t.errorRate;
 	return *this;
@@ -91,8 +95,8 @@ private:
 	uint32_t data_size, const char* quality, uint32_t quality_size);
 
     std::string name{};
-    std::string seq{};
-    std::string qual{};
+    PackedSeq seq{};
+    QualStore qual{};
     double score{};
     double errorRate{};
 };
@@ -1,29 +1,23 @@
 #include "serialize.h"
+#include "batch_file.h"
 #include "cluster.h"
 
-extern UnsignedHash uh;
 void SaveBatch(const std::unique_ptr<Batch>& b, std::string outf)
 {
-    std::ofstream os(outf, std::ios::binary);
-    cereal::BinaryOutputArchive archive(os);
-    archive(*b);
+    WriteBatchFile(*b, outf);
 }
 
-BatchP LoadBatch(std::string inf)
+BatchP LoadBatch(std::string inf, unsigned parts)
 {
-    std::ifstream instream(inf, std::ios::binary);
-
-    auto p = std::unique_ptr<Batch>(new Batch);
-    cereal::BinaryInputArchive iarchive(instream);
     try {
-	iarchive(*p);
+	return ReadBatchFile(inf, parts);
     }
     catch (std::runtime_error e) {
 	std::cerr << "Failed to load batch " << inf << ":" << e.what()
 		  << std::endl;
 	exit(1);
     }
-    return p;
+    return nullptr;
 }
 
 BatchP CreatePseudoBatch(std::unique_ptr<Batch>& inBatch)
@@ -36,8 +30,8 @@ BatchP CreatePseudoBatch(std::unique_ptr<Batch>& inBatch)
     nb->TotalReads = 0;
     nb->SortArgs = inBatch->SortArgs;
     nb->Depth = -1;
-    nb->Cls = Clusters(inBatch->Cls);
-    nb->NrCls = int(nb->Cls.size());
+    nb->Cls = inBatch->Cls;
+    nb->NrCls = int(nb->Cls.Size());
 
     return nb;
 }
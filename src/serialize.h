@@ -13,6 +13,7 @@
 
 #include "args.h"
 #include "cluster_data.h"
+#include "cluster_store.h"
 #include "minimizer.h"
 #include "spoa/spoa.hpp"
 
@@ -26,14 +27,14 @@ public:
     unsigned long long BatchStart;
     unsigned long long BatchEnd;
     unsigned long long BatchBases;
-    int TotalReads;
+    int TotalReads{};
     int NrCls{};
     CmdArgs SortArgs;
     std::string LeftLeaf{""};
     std::string RightLeaf{""};
     int Depth{0};
     MinimizerDB MinDB;
-    Clusters Cls;
+    ClusterStore Cls;
     ConsGraphs ConsGs;
     template <class Archive>
     void serialize(Archive& archive)
@@ -44,11 +45,12 @@ public:
 
     int NrClusters()
     {
-	if (NrCls == int(Cls.size())) {
+	if (NrCls == int(Cls.Size())) {
 	    int count = 0;
-	    for (const auto& c : Cls) {
-		if ((c != nullptr) && (c->at(0)->RawSeq != nullptr) &&
-		    (c->at(0)->RawSeq->Score() > -1)) {
+	    for (unsigned c = 0; c < Cls.Size(); c++) {
+		auto& r = Cls.Rep(c);
+		if ((r != nullptr) && (r->RawSeq != nullptr) &&
+		    (r->RawSeq->Score() > -1)) {
 		    count++;
 		}
 	    }
@@ -56,18 +58,19 @@ public:
 	}
 	else {
 	    std::cerr << "Inconsistent batch state: NrCluster " << NrCls
-		      << " vs " << Cls.size() << std::endl;
+		      << " vs " << Cls.Size() << std::endl;
 	    exit(1);
 	}
 	return -1;
     };
     int NrNontrivialClusters()
     {
-	if (NrCls == int(Cls.size())) {
+	if (NrCls == int(Cls.Size())) {
 	    int count = 0;
-	    for (const auto& c : Cls) {
-		if ((c != nullptr) && (c->at(0)->RawSeq != nullptr) &&
-		    (c->at(0)->RawSeq->Score() > -1) && (c->size() > 2)) {
+	    for (unsigned c = 0; c < Cls.Size(); c++) {
+		auto& r = Cls.Rep(c);
+		if ((r != nullptr) && (r->RawSeq != nullptr) &&
+		    (r->RawSeq->Score() > -1) && (Cls.NrMembers(c) > 1)) {
 		    count++;
 		}
 	    }
@@ -75,18 +78,19 @@ public:
 	}
 	else {
 	    std::cerr << "Inconsistent batch state: NrCluster " << NrCls
-		      << " vs " << Cls.size() << std::endl;
+		      << " vs " << Cls.Size() << std::endl;
 	    exit(1);
 	}
 	return -1;
     };
     int NrFilteredReads()
     {
-	if (NrCls == int(Cls.size())) {
+	if (NrCls == int(Cls.Size())) {
 	    int count = 0;
-	    for (const auto& c : Cls) {
-		if ((c != nullptr) && (c->at(0)->RawSeq != nullptr) &&
-		    (c->at(0)->RawSeq->Score() < 0)) {
+	    for (unsigned c = 0; c < Cls.Size(); c++) {
+		auto& r = Cls.Rep(c);
+		if ((r != nullptr) && (r->RawSeq != nullptr) &&
+		    (r->RawSeq->Score() < 0)) {
 		    count++;
 		}
 	    }
@@ -94,17 +98,24 @@ public:
 	}
 	else {
 	    std::cerr << "Inconsistent batch state: NrCluster " << NrCls
-		      << " vs " << Cls.size() << std::endl;
+		      << " vs " << Cls.Size() << std::endl;
 	    exit(1);
 	}
 	return -1;
     };
-    int MinDBSize() { return int(MinDB.size()); };
+    int MinDBSize() { return int(MinDB.Size()); };
 };
 
+// Parts of a batch for LoadBatch, the metadata is always loaded.
+#define BATCH_LOAD_META 0
+#define BATCH_LOAD_CLUSTERS 1
+#define BATCH_LOAD_MINDB 2
+#define BATCH_LOAD_CONSGS 4
+#define BATCH_LOAD_ALL 7
+
 void SaveBatch(const std::unique_ptr<Batch>& b, std::string outf);
 typedef std::unique_ptr<Batch> BatchP;
-BatchP LoadBatch(std::string inf);
+BatchP LoadBatch(std::string inf, unsigned parts = BATCH_LOAD_ALL);
 BatchP CreatePseudoBatch(std::unique_ptr<Batch>& inBatch);
 
 #endif
@@ -0,0 +1,322 @@
+#include "sort_stream.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <thread>
+
+#include "fastq_reader.h"
+#include "output.h"
+#include "serialize.h"
+
+using namespace std;
+
+BatchBuilder::BatchBuilder(const CmdArgs& args, const std::string& batchDir,
+			   const QualTab& qualTab, const QualTab& qualTabNomin)
+    : worker(graph, tbb::flow::unlimited,
+	     [this](PendingBatchP p) {
+		 prepareAndSave(*p);
+		 std::lock_guard<std::mutex> lock(mtx);
+		 inFlight--;
+	     }),
+      maxInFlight(MaxBatchesInFlight(args)),
+      args(args),
+      batchDir(batchDir),
+      qualTab(qualTab),
+      qualTabNomin(qualTabNomin)
+{
+}
+
+BatchBuilder::~BatchBuilder() { graph.wait_for_all(); }
+
+unsigned long long BatchFootprint(const CmdArgs& args)
+{
+    // The packed reads with a byte of quality, and their HPC copies of
+    // about 3/4 of the bases.
+    double perBase = 1.75 * 1.25;
+    // Forward and, unless canonical, reverse minimizers of the HPC bases, at
+    // the density 2 / (w - k + 2) of random minimizers.
+    auto density = 2.0 / std::max(2, args.WindowSize - args.KmerSize + 2);
+    perBase +=
+	0.75 * density * sizeof(Minimizer) * (args.CanonicalMins ? 1 : 2);
+    // The minimizer database and the encoded minimizers of SaveBatch take
+    // about as much again.
+    return (unsigned long long)(2.0 * perBase * args.BatchSize * 1000);
+}
+
+int MaxBatchesInFlight(const CmdArgs& args)
+{
+    auto res = args.BatchesInFlight;
+    if (res <= 0) {
+	res = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    if (args.MemBudget <= 0 || args.BatchSize <= 0) {
+	return res;
+    }
+    // The half of the budget left by the parser holds the batches in flight
+    // and the one filled or prepared by the caller.
+    auto fit = (unsigned long long)(args.MemBudget) * 1024 * 1024 / 2 /
+	       BatchFootprint(args);
+    return int(std::min((unsigned long long)(res), std::max(fit, 1ULL) - 1));
+}
+
+/// Check whether a batch with the given number of bases and reads is
+/// complete.
+bool BatchFull(const CmdArgs& args, unsigned long bases, size_t nrSeqs)
+{
+    return (args.BatchSize > 0) &&
+	   ((bases > (unsigned long)(args.BatchSize * 1000)) ||
+	    ((args.BatchMaxSeq > 0) && int(nrSeqs) >= args.BatchMaxSeq));
+}
+
+/// Start indices of the batches in the sorted reads, followed by the number
+/// of reads. Gives the same batches as adding the reads to a BatchBuilder.
+std::vector<size_t> BatchBoundaries(const SequencesP& sequences,
+				    const CmdArgs& args)
+{
+    std::vector<size_t> res{0};
+    unsigned long bases = 0;
+    for (size_t i = 0; i < sequences.size(); i++) {
+	bases += sequences[i]->Len();
+	if (BatchFull(args, bases, i + 1 - res.back())) {
+	    res.push_back(i + 1);
+	    bases = 0;
+	}
+    }
+    if (res.back() != sequences.size()) {
+	res.push_back(sequences.size());
+    }
+    return res;
+}
+
+void BatchBuilder::Add(std::unique_ptr<Seq> s)
+{
+    batchBases += s->Len();
+    pending.push_back(std::move(s));
+
+    if (BatchFull(args, batchBases, pending.size())) {
+	emit();
+    }
+}
+
+void BatchBuilder::AddBatch(SequencesP seqs)
+{
+    pending = std::move(seqs);
+    batchBases = 0;
+    for (auto& s : pending) {
+	batchBases += s->Len();
+    }
+    emit();
+}
+
+void BatchBuilder::Finish()
+{
+    if (pending.size() > 0) {
+	emit();
+    }
+    graph.wait_for_all();
+}
+
+void BatchBuilder::emit()
+{
+    // When the graph is full the batch is handled on the calling thread.
+    // Blocking here instead could stall if no TBB worker threads are
+    // available.
+    bool async;
+    {
+	std::lock_guard<std::mutex> lock(mtx);
+	async = inFlight < maxInFlight;
+	if (async) {
+	    inFlight++;
+	}
+    }
+
+    auto p = std::make_shared<PendingBatch>();
+    auto size = pending.size();
+    p->Seqs = std::move(pending);
+    p->Bases = batchBases;
+    p->Start = batchStart;
+    p->Nr = nrBatches;
+    if (async) {
+	worker.try_put(p);
+    }
+    else {
+	prepareAndSave(*p);
+    }
+
+    pending = SequencesP();
+    batchStart += size;
+    batchBases = 0;
+    nrBatches++;
+}
+
+void BatchBuilder::prepareAndSave(PendingBatch& p)
+{
+    auto size = p.Seqs.size();
+    const auto batch = std::unique_ptr<Batch>(PrepareSortedBatch(
+	p.Seqs, 0, int(size) - 1, p.Bases, args.KmerSize, args.WindowSize,
+	args.MinQual, qualTab, qualTabNomin, p.Start, args.BatchQual,
+	args.CanonicalMins, args.HashMins));
+    p.Seqs.clear();
+    batch->BatchStart = p.Start;
+    batch->BatchEnd = p.Start + size - 1;
+    batch->BatchNr = p.Nr;
+    batch->BatchBases = p.Bases;
+    batch->SortArgs = args;
+
+    auto outFile = batchDir + "/isONbatch_" + std::to_string(p.Nr) + ".cer";
+    SaveBatch(batch, outFile);
+
+    if (VERBOSE) {
+	std::lock_guard<std::mutex> lock(mtx);
+	cerr << "\tWritten batch " << p.Nr << " with " << size
+	     << " sequences and " << int((double(p.Bases) / 1000.0))
+	     << " kilobases." << endl;
+    }
+}
+
+void SpillSortedRun(SequencesP& sequences, const std::string& runFile)
+{
+    std::ofstream os(runFile, std::ios::binary);
+    if (!os.is_open()) {
+	std::cerr << "Failed to open " + runFile + "!" << std::endl;
+	exit(1);
+    }
+    cereal::BinaryOutputArchive archive(os);
+    archive((unsigned long long)(sequences.size()));
+    for (auto& s : sequences) {
+	archive(*s);
+    }
+}
+
+/// Sequential reader of a sorted run written by SpillSortedRun.
+class runReader {
+public:
+    runReader(const std::string& runFile, unsigned run)
+	: in(runFile, std::ios::binary), archive(in), Run(run)
+    {
+	if (!in.is_open()) {
+	    std::cerr << "Failed to open " + runFile + "!" << std::endl;
+	    exit(1);
+	}
+	archive(left);
+    }
+
+    bool Next()
+    {
+	if (left == 0) {
+	    Head = nullptr;
+	    return false;
+	}
+	Head = std::unique_ptr<Seq>(new Seq);
+	archive(*Head);
+	left--;
+	return true;
+    }
+
+    std::ifstream in;
+    cereal::BinaryInputArchive archive;
+    unsigned Run;
+    unsigned long long left{0};
+    std::unique_ptr<Seq> Head;
+};
+
+// Runs are spilled in input order, so breaking score ties by run number
+// reproduces the global stable sort.
+struct runOrder {
+    bool operator()(const runReader* a, const runReader* b) const
+    {
+	if (a->Head->Score() == b->Head->Score()) {
+	    return a->Run > b->Run;
+	}
+	return a->Head->Score() < b->Head->Score();
+    }
+};
+
+void MergeSortedRuns(const std::vector<std::string>& runFiles,
+		     const SeqSink& sink)
+{
+    std::vector<std::unique_ptr<runReader>> readers;
+    std::priority_queue<runReader*, std::vector<runReader*>, runOrder> heap;
+
+    for (unsigned i = 0; i < runFiles.size(); i++) {
+	readers.emplace_back(new runReader(runFiles[i], i));
+	if (readers.back()->Next()) {
+	    heap.push(readers.back().get());
+	}
+    }
+
+    while (!heap.empty()) {
+	auto r = heap.top();
+	heap.pop();
+	sink(std::move(r->Head));
+	if (r->Next()) {
+	    heap.push(r);
+	}
+    }
+}
+
+int StreamingSort(const CmdArgs& args, const std::string& batchDir,
+		  const QualTab& qualTab, const QualTab& qualTabNomin)
+{
+    auto runDir = args.BatchOutFolder + "/sort_runs";
+    CreateOutdir(runDir);
+
+    // Leave half of the budget for parser buffers and the batches being
+    // built, see MaxBatchesInFlight.
+    auto chunkBytes = (unsigned long long)(args.MemBudget) * 1024 * 1024 / 2;
+    MultiFastqReader reader(args.InFastqs);
+
+    std::vector<std::string> runFiles;
+    unsigned long long nrSeqs = 0;
+    while (true) {
+	auto chunk = reader.Parse(chunkBytes);
+	if (chunk.size() == 0) {
+	    break;
+	}
+	nrSeqs += chunk.size();
+	FillQualScores(chunk, args.KmerSize, args.WindowSize, qualTab,
+		       qualTabNomin);
+	SortByQualScores(chunk);
+	auto runFile =
+	    runDir + "/run_" + std::to_string(runFiles.size()) + ".cer";
+	SpillSortedRun(chunk, runFile);
+	runFiles.push_back(runFile);
+	if (VERBOSE) {
+	    cerr << "\tSpilled sorted run " << runFiles.size() - 1 << " with "
+		 << chunk.size() << " sequences." << endl;
+	}
+    }
+
+    if (VERBOSE) {
+	cerr << "Parsed " << nrSeqs << " sequences into " << runFiles.size()
+	     << " sorted runs." << endl;
+	cerr << "Merging sorted runs and preparing batches:" << endl;
+    }
+
+    SortedWriter writer(args.BatchOutFolder, args.ExportFastq);
+    BatchBuilder builder(args, batchDir, qualTab, qualTabNomin);
+    MergeSortedRuns(runFiles, [&](std::unique_ptr<Seq> s) {
+	writer.Add(*s);
+	builder.Add(std::move(s));
+    });
+    builder.Finish();
+    writer.Close();
+
+    for (auto& f : runFiles) {
+	remove(f.c_str());
+    }
+    rmdir(runDir.c_str());
+
+    if (VERBOSE) {
+	cerr << "Sorted sequences written to: " << writer.Store() << endl;
+	if (!writer.Fastq().empty()) {
+	    cerr << "Sorted fastq exported to: " << writer.Fastq() << endl;
+	}
+	cerr << "Scores written to: " << writer.ScoresTsv() << endl;
+    }
+
+    return builder.NrBatches();
+}
@@ -0,0 +1,81 @@
+#ifndef SORT_STREAM_H_INCLUDED
+#define SORT_STREAM_H_INCLUDED
+
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "qualscore.h"
+#include "seq.h"
+#include "tbb/flow_graph.h"
+
+typedef struct {
+    SequencesP Seqs;
+    unsigned long Bases;
+    unsigned long long Start;
+    int Nr;
+} PendingBatch;
+
+typedef std::shared_ptr<PendingBatch> PendingBatchP;
+
+/// Accumulates sorted reads and writes out a batch whenever the batch size
+/// limits are reached. Full batches are prepared and saved concurrently by
+/// a flow graph node while the caller keeps producing reads. At most
+/// MaxBatchesInFlight batches are held by the graph, further batches are
+/// handled by the caller.
+class BatchBuilder {
+public:
+    BatchBuilder(const CmdArgs& args, const std::string& batchDir,
+		 const QualTab& qualTab, const QualTab& qualTabNomin);
+    ~BatchBuilder();
+    void Add(std::unique_ptr<Seq> s);
+    /// Emit a whole batch, the pending reads must have been emitted.
+    void AddBatch(SequencesP seqs);
+    /// Emit the last batch and wait until all batches are saved.
+    void Finish();
+    int NrBatches() const { return nrBatches; }
+
+private:
+    void emit();
+    void prepareAndSave(PendingBatch& p);
+
+    tbb::flow::graph graph;
+    tbb::flow::function_node<PendingBatchP> worker;
+    std::mutex mtx;
+    int inFlight{0};
+    int maxInFlight;
+    const CmdArgs& args;
+    std::string batchDir;
+    const QualTab& qualTab;
+    const QualTab& qualTabNomin;
+    SequencesP pending;
+    unsigned long batchBases{0};
+    unsigned long long batchStart{0};
+    int nrBatches{0};
+};
+
+typedef std::function<void(std::unique_ptr<Seq>)> SeqSink;
+
+/// Estimated peak memory of a batch while it is prepared and saved.
+unsigned long long BatchFootprint(const CmdArgs& args);
+/// Batches a BatchBuilder hands to its graph: BatchesInFlight, or the number
+/// of cores if it is not set. With a memory budget it is capped so that they
+/// and the batch of the caller fit in half of the budget, down to 0 when
+/// only the batch of the caller does.
+int MaxBatchesInFlight(const CmdArgs& args);
+
+bool BatchFull(const CmdArgs& args, unsigned long bases, size_t nrSeqs);
+std::vector<size_t> BatchBoundaries(const SequencesP& sequences,
+				    const CmdArgs& args);
+
+void SpillSortedRun(SequencesP& sequences, const std::string& runFile);
+void MergeSortedRuns(const std::vector<std::string>& runFiles,
+		     const SeqSink& sink);
+int StreamingSort(const CmdArgs& args, const std::string& batchDir,
+		  const QualTab& qualTab, const QualTab& qualTabNomin);
+
+#endif
@@ -3,38 +3,108 @@
 #include <cstdlib>
 #include <string>
 
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
 double round(double number, int precision)
 {
     int decimals = std::pow(10, precision);
     return (std::round(number * decimals)) / decimals;
 }
 
-// From: https://stackoverflow.com/a/42549427/5504770
-std::string RevComp(const std::string& oseq)
-{
-    auto DNAseq = std::string(oseq);
-    std::reverse(DNAseq.begin(), DNAseq.end());
-    for (std::size_t i = 0; i < DNAseq.length(); ++i) {
-	switch (DNAseq[i]) {
-	    case 'A':
-		DNAseq[i] = 'T';
-		break;
-	    case 'C':
-		DNAseq[i] = 'G';
-		break;
-	    case 'G':
-		DNAseq[i] = 'C';
-		break;
-	    case 'T':
-		DNAseq[i] = 'A';
-		break;
-	    default:
-		throw("Invalid base encountered: " + std::string(1, DNAseq[i]) +
-		      "\n");
-		break;
+// Complement of every byte, letters keep their case. Low holds the
+// complement of the letter with the low five bits i; letters that are not
+// IUPAC codes map to themselves, U pairs with A.
+struct compTable {
+    char Low[32];
+    char Comp[256];
+    compTable()
+    {
+	for (int i = 0; i < 32; i++) {
+	    Low[i] = char(i);
+	}
+	const char* pairs = "ATTAUACGGCRYYRKMMKBVVBDHHD";
+	for (int i = 0; pairs[i] != 0; i += 2) {
+	    Low[pairs[i] & 31] = char(pairs[i + 1] & 31);
 	}
+	for (int c = 0; c < 256; c++) {
+	    Comp[c] = ((c & 0xc0) == 0x40) ? char((c & 0xe0) | Low[c & 31])
+					   : char(c);
+	}
+    }
+};
+
+static const compTable compTab;
+
+#if defined(__SSSE3__)
+// compTable on 16 bytes: two shuffles on the low four bits, picked by the
+// fifth one.
+static inline __m128i compVec(__m128i v)
+{
+    const auto low =
+	_mm_loadu_si128(reinterpret_cast<const __m128i*>(compTab.Low));
+    const auto high =
+	_mm_loadu_si128(reinterpret_cast<const __m128i*>(compTab.Low + 16));
+    auto idx = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+    auto bit4 = _mm_set1_epi8(0x10);
+    auto useHigh = _mm_cmpeq_epi8(_mm_and_si128(v, bit4), bit4);
+    auto t = _mm_or_si128(_mm_and_si128(useHigh, _mm_shuffle_epi8(high, idx)),
+			  _mm_andnot_si128(useHigh, _mm_shuffle_epi8(low, idx)));
+    auto comp = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi8(char(0xe0))), t);
+    auto letter = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xc0))),
+				 _mm_set1_epi8(0x40));
+    return _mm_or_si128(_mm_and_si128(letter, comp),
+			_mm_andnot_si128(letter, v));
+}
+
+static inline __m128i revCompVec(const char* p)
+{
+    const auto rev =
+	_mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return compVec(_mm_shuffle_epi8(v, rev));
+}
+#endif
+
+void RevCompTo(const char* seq, size_t len, char* out)
+{
+    size_t lo = 0;
+    size_t hi = len;
+#if defined(__SSSE3__)
+    // Both ends are loaded before storing, so that out can be seq.
+    for (; hi - lo >= 32; lo += 16, hi -= 16) {
+	auto a = revCompVec(seq + lo);
+	auto b = revCompVec(seq + hi - 16);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + lo), b);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + hi - 16), a);
+    }
+#endif
+    for (; lo + 1 < hi; lo++, hi--) {
+	auto a = compTab.Comp[uint8_t(seq[lo])];
+	auto b = compTab.Comp[uint8_t(seq[hi - 1])];
+	out[lo] = b;
+	out[hi - 1] = a;
+    }
+    if (lo + 1 == hi) {
+	out[lo] = compTab.Comp[uint8_t(seq[lo])];
+    }
+}
+
+void RevCompInPlace(std::string& seq)
+{
+    if (!seq.empty()) {
+	RevCompTo(&seq[0], seq.length(), &seq[0]);
+    }
+}
+
+std::string RevComp(const std::string& seq)
+{
+    std::string res(seq.length(), 0);
+    if (!seq.empty()) {
+	RevCompTo(seq.data(), seq.length(), &res[0]);
     }
-    return DNAseq;
+    return res;
 }
 
 double rand_double()
@@ -8,6 +8,11 @@
 
 double round(double number, int precision);
 double rand_double();
+/// Reverse complement of len characters of seq into out, which may also
+/// be seq. IUPAC codes map to their complement and keep their case, other
+/// characters are copied.
+void RevCompTo(const char* seq, size_t len, char* out);
+void RevCompInPlace(std::string& seq);
 std::string RevComp(const std::string& seq);
 
 #endif
@@ -0,0 +1,765 @@
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "arena.h"
+#include "bioparser/parser.hpp"
+#include "fastq_reader.h"
+#include "hpc.h"
+#include "kmer_index.h"
+#include "minimizer.h"
+#include "out_buffer.h"
+#include "output.h"
+#include "p_emp_prob.h"
+#include "seq.h"
+#include "tbb/parallel_for.h"
+#include "util.h"
+
+typedef std::function<int(int argc, char** argv)> Benchmark;
+
+// Count calls to the global allocator.
+static unsigned long long NR_ALLOCS{0};
+
+void* operator new(size_t n)
+{
+    NR_ALLOCS++;
+    auto p = malloc(n == 0 ? 1 : n);
+    if (p == nullptr) {
+	throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+// Peak resident set size in megabytes.
+static double peakRss()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return double(ru.ru_maxrss) / 1024.0;
+}
+
+// Run fn and return the elapsed wall clock time in seconds.
+double timeIt(const std::function<void()>& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+void report(const std::string& name, double secs, double items,
+	    const std::string& unit)
+{
+    std::cout << name << "\t" << secs << " s\t" << items / secs << " " << unit
+	      << "/s" << std::endl;
+}
+
+// Compare bioparser with the parallel fastq reader on one file.
+int benchFastq(int argc, char** argv)
+{
+    if (argc < 3) {
+	std::cerr << "Usage: bench_isONclust2 fastq <input.fq>" << std::endl;
+	return 1;
+    }
+    std::string inFastq = argv[2];
+    SequencesP seqs;
+
+    auto bp = timeIt([&]() {
+	auto p = bioparser::Parser<Seq>::Create<bioparser::FastqParser>(inFastq);
+	seqs = p->Parse(-1);
+    });
+    report("bioparser", bp, double(seqs.size()), "records");
+    seqs.clear();
+
+    auto fr = timeIt([&]() { seqs = ParseFastqParallel(inFastq); });
+    report("FastqReader", fr, double(seqs.size()), "records");
+    std::cout << "speedup\t" << bp / fr << std::endl;
+    return 0;
+}
+
+// Write the sorted fastq and score table with std::endl after every line,
+// like the writers did before the buffered output layer.
+static void writeWithEndl(SequencesP& seqs, const std::string& outFastq,
+			  const std::string& outScores)
+{
+    std::ofstream fq(outFastq);
+    std::ofstream sc(outScores);
+    for (auto& s : seqs) {
+	fq << "@" << s->Name() << std::endl;
+	fq << s->Str() << std::endl;
+	fq << "+" << std::endl;
+	fq << s->Qual() << std::endl;
+	sc << s->Name() << "\t" << s->Score() << std::endl;
+    }
+}
+
+static void writeBuffered(SequencesP& seqs, const std::string& outFastq,
+			  const std::string& outScores, bool async)
+{
+    OutBuffer fq;
+    OutBuffer sc;
+    CreateFile(outFastq, fq, async);
+    CreateFile(outScores, sc, async);
+    for (auto& s : seqs) {
+	WriteFastqRecord(*s, fq);
+	sc << s->Name() << '\t' << s->Score() << '\n';
+    }
+}
+
+// Records/s of the fastq and score writers with and without buffering.
+int benchOutput(int argc, char** argv)
+{
+    if (argc < 3) {
+	std::cerr << "Usage: bench_isONclust2 output <input.fq>" << std::endl;
+	return 1;
+    }
+    auto seqs = ParseFastqParallel(argv[2]);
+    auto n = double(seqs.size());
+    std::string outFastq = "bench_output.fq";
+    std::string outScores = "bench_output.tsv";
+
+    auto endl = timeIt([&]() { writeWithEndl(seqs, outFastq, outScores); });
+    report("ofstream+endl", endl, n, "records");
+    auto sync =
+	timeIt([&]() { writeBuffered(seqs, outFastq, outScores, false); });
+    report("OutBuffer", sync, n, "records");
+    auto async =
+	timeIt([&]() { writeBuffered(seqs, outFastq, outScores, true); });
+    report("OutBuffer async", async, n, "records");
+    std::cout << "speedup\t" << endl / std::min(sync, async) << std::endl;
+
+    std::remove(outFastq.c_str());
+    std::remove(outScores.c_str());
+    return 0;
+}
+
+// Random reads from a few templates with 5% substitutions.
+static std::vector<PackedSeq> simulateReads(unsigned nrTemplates,
+					    unsigned nrReads, unsigned len)
+{
+    std::mt19937 rng(42);
+    const char* bases = "ACGT";
+    std::vector<std::string> templates(nrTemplates, std::string(len, 'A'));
+    for (auto& t : templates) {
+	for (auto& c : t) {
+	    c = bases[rng() % 4];
+	}
+    }
+    std::vector<PackedSeq> reads;
+    for (unsigned i = 0; i < nrReads; i++) {
+	auto r = templates[rng() % nrTemplates];
+	for (auto& c : r) {
+	    if (rng() % 20 == 0) {
+		c = bases[rng() % 4];
+	    }
+	}
+	reads.emplace_back(r);
+    }
+    return reads;
+}
+
+// Minimizer and hit queries of each read, with the scratch space on the
+// heap or in an arena reset for every read. Run with heap or arena only
+// to compare the peak RSS of the two.
+int benchArena(int argc, char** argv)
+{
+    std::string mode = (argc > 2 ? argv[2] : "both");
+    const int kmerSize = 13;
+    const int windowSize = 20;
+    auto reads = simulateReads(50, 5000, 2000);
+    MinimizerDB db;
+    for (unsigned i = 0; i < 50; i++) {
+	auto kmers = KmerEncodeSeq(reads[i], kmerSize);
+	AddMinimizers(GetKmerMinimizers(kmers, kmerSize, windowSize), i, db);
+    }
+
+    auto query = [&](Arena* arena) {
+	size_t nrHits = 0;
+	for (auto& r : reads) {
+	    if (arena != nullptr) {
+		arena->Reset();
+	    }
+	    auto kmers = KmerEncodeSeq(r, kmerSize, arena);
+	    auto revKmers = KmerEncodeSeq(RevComp(r.Unpack()), kmerSize, arena);
+	    auto mins = GetKmerMinimizers(kmers, kmerSize, windowSize);
+	    auto revMins = GetKmerMinimizers(revKmers, kmerSize, windowSize);
+	    auto hits = GetMinimizerHits(mins, revMins, db, arena);
+	    nrHits += hits.size();
+	}
+	return nrHits;
+    };
+
+    auto n = double(reads.size());
+    for (auto useArena : {false, true}) {
+	if ((useArena && mode == "heap") || (!useArena && mode == "arena")) {
+	    continue;
+	}
+	Arena arena;
+	auto before = NR_ALLOCS;
+	size_t nrHits = 0;
+	auto secs =
+	    timeIt([&]() { nrHits = query(useArena ? &arena : nullptr); });
+	auto name = std::string(useArena ? "arena" : "heap");
+	report(name, secs, n, "reads");
+	std::cout << name << "\tallocations/read\t"
+		  << double(NR_ALLOCS - before) / n << "\thits\t" << nrHits
+		  << std::endl;
+    }
+    std::cout << "peak RSS\t" << peakRss() << " MB" << std::endl;
+    return 0;
+}
+
+// Reverse complement as it was done before the lookup table: a copy, a
+// reversal and a switch per base.
+static std::string switchRevComp(const std::string& seq)
+{
+    auto res = seq;
+    std::reverse(res.begin(), res.end());
+    for (auto& c : res) {
+	switch (c) {
+	    case 'A':
+		c = 'T';
+		break;
+	    case 'C':
+		c = 'G';
+		break;
+	    case 'G':
+		c = 'C';
+		break;
+	    case 'T':
+		c = 'A';
+		break;
+	    default:
+		throw("Invalid base encountered: " + std::string(1, c) + "\n");
+	}
+    }
+    return res;
+}
+
+// Bases/s of the reverse complement with a switch per base, with the
+// lookup table into a new string and in place.
+int benchRevComp(int argc, char** argv)
+{
+    auto reads = simulateReads(50, 5000, 2000);
+    std::vector<std::string> strs;
+    for (auto& r : reads) {
+	strs.push_back(r.Unpack());
+    }
+    auto n = double(strs.size()) * 2000;
+    size_t sum = 0;
+
+    auto old = timeIt([&]() {
+	for (auto& s : strs) {
+	    sum += size_t(switchRevComp(s)[0]);
+	}
+    });
+    report("switch", old, n, "bases");
+    auto copy = timeIt([&]() {
+	for (auto& s : strs) {
+	    sum += size_t(RevComp(s)[0]);
+	}
+    });
+    report("table", copy, n, "bases");
+    auto inPlace = timeIt([&]() {
+	for (auto& s : strs) {
+	    RevCompInPlace(s);
+	    sum += size_t(s[0]);
+	}
+    });
+    report("table in place", inPlace, n, "bases");
+
+    bool same = true;
+    for (unsigned i = 0; i < 100; i++) {
+	same = same && (switchRevComp(reads[i].Unpack()) == strs[i]);
+    }
+    std::cout << "identical\t" << (same ? "yes" : "no") << "\tchecksum\t"
+	      << sum << std::endl;
+    std::cout << "speedup\t" << old / inPlace << std::endl;
+    return 0;
+}
+
+// K-mer encoding as it was done before the rolling encoder: a substring
+// and a recursive encoding per position.
+static KmerSeq substrKmers(const std::string& seq, unsigned kmerSize)
+{
+    KmerSeq res;
+    if (seq.length() < kmerSize) {
+	return res;
+    }
+    res.reserve(seq.length() - kmerSize);
+    for (unsigned i = 0; i < seq.length() - kmerSize; i++) {
+	auto kmer = seq.substr(i, kmerSize);
+	res.emplace_back(KmerToIndex(kmer, kmer.end()));
+    }
+    return res;
+}
+
+// Bases/s of the per k-mer encoding and of the rolling encoder on strings
+// and on packed bases, with 32 and 64-bit words.
+int benchKmers(int argc, char** argv)
+{
+    unsigned kmerSize = (argc > 2 ? unsigned(atoi(argv[2])) : 15);
+    auto reads = simulateReads(50, 5000, 2000);
+    std::vector<std::string> strs;
+    for (auto& r : reads) {
+	strs.push_back(r.Unpack());
+    }
+    auto n = double(reads.size()) * 2000;
+    Arena arena;
+    uint64_t sum = 0;
+    bool same = true;
+
+    auto old = timeIt([&]() {
+	for (auto& s : strs) {
+	    sum += substrKmers(s, kmerSize).back();
+	}
+    });
+    report("substr", old, n, "bases");
+    auto str = timeIt([&]() {
+	for (auto& s : strs) {
+	    sum += KmerEncodeSeq(s, kmerSize).back();
+	}
+    });
+    report("rolling string", str, n, "bases");
+    auto packed = timeIt([&]() {
+	for (auto& r : reads) {
+	    arena.Reset();
+	    sum += KmerEncodeSeq(r, kmerSize, &arena).back();
+	}
+    });
+    report("rolling packed", packed, n, "bases");
+
+    for (unsigned i = 0; i < 100; i++) {
+	same = same && (substrKmers(strs[i], kmerSize) ==
+			KmerEncodeSeq(reads[i], kmerSize));
+    }
+    std::cout << "identical\t" << (same ? "yes" : "no") << "\tchecksum\t"
+	      << sum << std::endl;
+    std::cout << "speedup\t" << old / packed << std::endl;
+    return 0;
+}
+
+// Homopolymer compression as it was before the block kernel: a base at a
+// time, appending the qualities to a string.
+template <typename At, typename Keep>
+static std::string appendRuns(unsigned len, const std::string& qual, At at,
+			      Keep keep)
+{
+    std::string compQual;
+    compQual.reserve(len);
+    auto currBase = at(0);
+    char currQual = qual[0];
+    keep(0);
+    for (unsigned i = 1; i < len; i++) {
+	auto base = at(i);
+	if (base != currBase) {
+	    currBase = base;
+	    keep(i);
+	    compQual += currQual;
+	    currQual = qual[i];
+	}
+	else if (currQual < qual[i]) {
+	    currQual = qual[i];
+	}
+    }
+    compQual += currQual;
+    return compQual;
+}
+
+static Seq appendHpc(const Seq& s)
+{
+    auto& p = s.Packed();
+    auto bytes = p.Bytes().data();
+    auto code = [bytes](unsigned i) {
+	return (bytes[i / 4] >> (2 * (i % 4))) & 3;
+    };
+    std::vector<uint8_t> out(p.Bytes().size(), 0);
+    unsigned n = 0;
+    auto qual = s.Qual();
+    auto compQual = appendRuns(p.Len(), qual, code, [&](unsigned i) {
+	out[n / 4] |= uint8_t(code(i) << (2 * (n % 4)));
+	n++;
+    });
+    return Seq(s.Name(), PackedSeq(n, out.data(), nullptr, nullptr, 0),
+	       QualStore(compQual), s.Score());
+}
+
+// Bases/s of homopolymer compression a base at a time and with the block
+// kernel, with the scratch space on the heap and in an arena.
+int benchHpc(int argc, char** argv)
+{
+    auto reads = simulateReads(50, 5000, 2000);
+    std::mt19937 rng(7);
+    std::vector<Seq> seqs;
+    for (auto& r : reads) {
+	std::string qual(r.Len(), 0);
+	for (auto& q : qual) {
+	    q = char('!' + rng() % 40);
+	}
+	seqs.emplace_back("read", r.Unpack(), qual, 0.0);
+    }
+    auto n = double(reads.size()) * 2000;
+    Arena arena;
+    size_t sum = 0;
+
+    auto old = timeIt([&]() {
+	for (auto& s : seqs) {
+	    sum += appendHpc(s).Len();
+	}
+    });
+    report("base at a time", old, n, "bases");
+    auto heap = timeIt([&]() {
+	for (auto& s : seqs) {
+	    sum += HomopolymerCompressObj(s).Len();
+	}
+    });
+    report("blocks", heap, n, "bases");
+    auto inArena = timeIt([&]() {
+	for (auto& s : seqs) {
+	    arena.Reset();
+	    sum += HomopolymerCompressObj(s, &arena).Len();
+	}
+    });
+    report("blocks arena", inArena, n, "bases");
+
+    bool same = true;
+    for (unsigned i = 0; i < 100; i++) {
+	auto a = appendHpc(seqs[i]);
+	auto b = HomopolymerCompressObj(seqs[i]);
+	same = same && a.Str() == b.Str() && a.Qual() == b.Qual();
+    }
+    std::cout << "identical\t" << (same ? "yes" : "no") << "\tchecksum\t"
+	      << sum << std::endl;
+    std::cout << "speedup\t" << old / inArena << std::endl;
+    return 0;
+}
+
+// Distribution of the posting list lengths of a minimizer database, and
+// the postings a lookup walks on average (sum len^2 / sum len).
+static void reportPostings(const std::string& name, const MinimizerDB& db)
+{
+    std::vector<size_t> lens;
+    double total = 0;
+    double walked = 0;
+    db.ForEach([&](unsigned, const PostingList& p) {
+	lens.push_back(p.size());
+	total += double(p.size());
+	walked += double(p.size()) * double(p.size());
+    });
+    std::sort(lens.begin(), lens.end());
+    auto q = [&lens](double f) {
+	return lens.empty() ? 0 : lens[size_t(f * double(lens.size() - 1))];
+    };
+    std::cout << name << "\tkeys\t" << lens.size() << "\tmean\t"
+	      << total / double(lens.size()) << "\tp50\t" << q(0.5)
+	      << "\tp99\t" << q(0.99) << "\tp99.9\t" << q(0.999) << "\tmax\t"
+	      << q(1.0) << "\twalked/lookup\t" << walked / total << std::endl;
+}
+
+// Posting lists with minimizers ordered by k-mer code and by hash, with
+// every read of a fastq file, or of simulated reads, as its own cluster.
+int benchPostings(int argc, char** argv)
+{
+    const int kmerSize = 13;
+    const int windowSize = 20;
+    std::vector<std::unique_ptr<Seq>> hpcReads;
+    if (argc > 2) {
+	for (auto& s : ParseFastqParallel(argv[2])) {
+	    hpcReads.emplace_back(HomopolymerCompress(s));
+	}
+    }
+    else {
+	std::mt19937 rng(42);
+	for (unsigned i = 0; i < 20000; i++) {
+	    std::string seq;
+	    while (seq.size() < 1000) {
+		auto c = "ACGT"[rng() % 4];
+		if (seq.empty() || seq.back() != c) {
+		    seq += c;
+		}
+	    }
+	    hpcReads.emplace_back(
+		new Seq("", seq, std::string(seq.size(), 'I'), 0.0));
+	}
+    }
+
+    for (auto hashOrder : {false, true}) {
+	MinimizerDB db;
+	Minimizers mins;
+	Minimizers revMins;
+	unsigned cls = 0;
+	for (auto& r : hpcReads) {
+	    if (r->Len() < unsigned(windowSize)) {
+		continue;
+	    }
+	    SeqMinimizers(*r, kmerSize, windowSize, false, hashOrder, mins,
+			  revMins);
+	    AddMinimizers(mins, cls++, db);
+	}
+	reportPostings(hashOrder ? "hash" : "code", db);
+    }
+    return 0;
+}
+
+// The minimizer database and the unordered_map of vectors it replaced, at
+// 1M, 10M and 100M keys with a few postings each, or up to the given number
+// of keys. Half of the lookups are misses. The map is skipped above 10M
+// keys, where it needs more memory than most machines running this have.
+int benchMinDB(int argc, char** argv)
+{
+    typedef std::unordered_map<unsigned, std::vector<unsigned>> MapDB;
+    size_t maxKeys = argc > 2 ? std::stoul(argv[2]) : 100000000;
+    const size_t nrLookups = 10000000;
+    for (size_t nrKeys = 1000000; nrKeys <= maxKeys; nrKeys *= 10) {
+	// Keys with mostly one to three postings, some lists of up to 32,
+	// generated again for each table.
+	auto build =
+	    [nrKeys](const std::function<void(unsigned, unsigned)>& add) {
+	    std::mt19937 rng(11);
+	    for (size_t i = 0; i < nrKeys; i++) {
+		auto key = unsigned(rng());
+		auto len = 1 + (rng() % 8 == 0 ? rng() % 32 : rng() % 3);
+		add(key, len);
+	    }
+	};
+	std::vector<unsigned> queries;
+	queries.reserve(nrLookups);
+	std::mt19937 rng(13);
+	std::poisson_distribution<unsigned> perKey(double(nrLookups / 2) /
+						   double(nrKeys));
+	build([&](unsigned key, unsigned) {
+	    for (auto n = perKey(rng); n > 0; n--) {
+		queries.push_back(key);
+	    }
+	});
+	for (size_t i = 0; i < nrLookups / 2; i++) {
+	    queries.push_back(unsigned(rng()));
+	}
+	std::shuffle(queries.begin(), queries.end(), rng);
+	auto nrQueries = double(queries.size());
+	auto label = std::to_string(nrKeys / 1000000) + "M";
+
+	size_t sum = 0;
+	{
+	    MinimizerDB db;
+	    auto before = NR_ALLOCS;
+	    auto secs = timeIt([&]() {
+		build([&db](unsigned key, unsigned len) {
+		    for (unsigned j = 0; j < len; j++) {
+			db.Append(key, j);
+		    }
+		});
+	    });
+	    report("flat build " + label, secs, double(nrKeys), "keys");
+	    std::cout << "flat " << label << "\tbytes/key\t"
+		      << double(db.MemoryUsage()) / double(db.Size())
+		      << "\tallocations/key\t"
+		      << double(NR_ALLOCS - before) / double(db.Size())
+		      << std::endl;
+	    secs = timeIt([&]() {
+		for (auto q : queries) {
+		    sum += db.Find(q).size();
+		}
+	    });
+	    report("flat lookup " + label, secs, nrQueries, "lookups");
+	    secs = timeIt([&]() {
+		for (size_t i = 0; i < queries.size(); i++) {
+		    if (i + MIN_DB_PREFETCH < queries.size()) {
+			db.Prefetch(queries[i + MIN_DB_PREFETCH]);
+		    }
+		    sum += db.Find(queries[i]).size();
+		}
+	    });
+	    report("flat prefetched lookup " + label, secs, nrQueries,
+		   "lookups");
+	}
+
+	if (nrKeys <= 10000000) {
+	    MapDB db;
+	    auto before = NR_ALLOCS;
+	    auto secs = timeIt([&]() {
+		build([&db](unsigned key, unsigned len) {
+		    auto& v = db[key];
+		    for (unsigned j = 0; j < len; j++) {
+			v.push_back(j);
+		    }
+		});
+	    });
+	    report("map build " + label, secs, double(nrKeys), "keys");
+	    std::cout << "map " << label << "\tallocations/key\t"
+		      << double(NR_ALLOCS - before) / double(db.size())
+		      << std::endl;
+	    secs = timeIt([&]() {
+		for (auto q : queries) {
+		    auto it = db.find(q);
+		    sum += it == db.end() ? 0 : it->second.size();
+		}
+	    });
+	    report("map lookup " + label, secs, nrQueries, "lookups");
+	}
+	std::cout << "checksum\t" << sum << std::endl;
+    }
+    return 0;
+}
+
+#define HASH_SIM_READS 64
+#define HASH_SIM_LEN 1000
+
+// Homopolymer compressed copy of a template with substitutions, deletions
+// and insertions at a third of rate e each.
+static std::string simulateRead(const std::string& tmpl, double e,
+				std::mt19937& rng)
+{
+    const char* bases = "ACGT";
+    std::string read;
+    read.reserve(tmpl.size() * 2);
+    for (auto c : tmpl) {
+	auto u = double(rng()) / 4294967296.0;
+	if (u < e / 3) {
+	    read += bases[rng() % 4];
+	}
+	else if (u < 2 * e / 3) {
+	    continue;
+	}
+	else if (u < e) {
+	    read += c;
+	    read += bases[rng() % 4];
+	}
+	else {
+	    read += c;
+	}
+    }
+    std::string hpc(read.size(), 0);
+    std::string unused(read.size(), 0);
+    auto n = CompressRuns(read.data(), read.data(), unsigned(read.size()),
+			  &hpc[0], &unused[0]);
+    hpc.resize(n);
+    return hpc;
+}
+
+// Minimizers of a are counted in tot, the ones also in b in shared.
+static void countShared(const KmerSeq& a, const KmerSeq& b, int kmerSize,
+			int windowSize, double& shared, double& tot)
+{
+    auto minsA = GetKmerMinimizers(a, kmerSize, windowSize);
+    auto minsB = GetKmerMinimizers(b, kmerSize, windowSize);
+    std::unordered_set<unsigned> inB;
+    for (auto& m : minsB) {
+	inB.insert(m.Min);
+    }
+    for (auto& m : minsA) {
+	shared += double(inB.count(m.Min));
+    }
+    tot += double(minsA.size());
+}
+
+// Ratio of the fraction of shared minimizers with the hash order over the
+// one with the code order, on the same simulated pairs of reads.
+static double simulateHashRatio(int kmerSize, int windowSize, double e1,
+				double e2, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    double lexShared{0}, lexTot{0}, hashShared{0}, hashTot{0};
+    for (unsigned r = 0; r < HASH_SIM_READS; r++) {
+	std::string tmpl;
+	while (tmpl.size() < HASH_SIM_LEN) {
+	    auto c = "ACGT"[rng() % 4];
+	    if (tmpl.empty() || tmpl.back() != c) {
+		tmpl += c;
+	    }
+	}
+	auto a = KmerEncodeSeq(simulateRead(tmpl, e1, rng), kmerSize);
+	auto b = KmerEncodeSeq(simulateRead(tmpl, e2, rng), kmerSize);
+	if (int(std::min(a.size(), b.size())) < windowSize) {
+	    continue;
+	}
+	countShared(a, b, kmerSize, windowSize, lexShared, lexTot);
+	for (auto& x : a) {
+	    x = HashKmer(x, kmerSize);
+	}
+	for (auto& x : b) {
+	    x = HashKmer(x, kmerSize);
+	}
+	countShared(a, b, kmerSize, windowSize, hashShared, hashTot);
+    }
+    if (lexShared == 0 || hashTot == 0) {
+	return 1.0;
+    }
+    return (hashShared / hashTot) / (lexShared / lexTot);
+}
+
+// Generate the rows of pMinHashText for k from minK to maxK: the rows of
+// pMinText scaled by the simulated effect of the hash order, so that the
+// simulation model cancels out. Prints them as they appear in
+// p_emp_prob_data.h. Each row has its own seed, so any k range gives the
+// same rows.
+int benchHashProbs(int argc, char** argv)
+{
+    int minK = argc > 2 ? atoi(argv[2]) : 10;
+    int maxK = argc > 3 ? atoi(argv[3]) : 30;
+    typedef std::tuple<int, int, double, double, double> Row;
+    std::vector<Row> rows;
+    std::istringstream lines(pMinText);
+    std::string line;
+    while (getline(lines, line, '\n')) {
+	auto row = parseMinTextLine(line);
+	if (std::get<0>(row) >= minK && std::get<0>(row) <= maxK) {
+	    rows.push_back(row);
+	}
+    }
+    std::vector<double> probs(rows.size());
+    tbb::parallel_for(size_t(0), rows.size(), [&](size_t i) {
+	int k, w;
+	double p, e1, e2;
+	std::tie(k, w, p, e1, e2) = rows[i];
+	auto seed = unsigned(k * 1000003 + w * 1009 +
+			     int(std::lround(e1 * 100)) * 101 +
+			     int(std::lround(e2 * 100)));
+	probs[i] = std::min(1.0, p * simulateHashRatio(k, w, e1, e2, seed));
+    });
+    for (size_t i = 0; i < rows.size(); i++) {
+	printf("    \"%d\t%d\t%.17g\t%f\t%f\\n\"\n", std::get<0>(rows[i]),
+	       std::get<1>(rows[i]), probs[i], std::get<3>(rows[i]),
+	       std::get<4>(rows[i]));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, Benchmark> benchmarks{
+	{"fastq", benchFastq},
+	{"output", benchOutput},
+	{"arena", benchArena},
+	{"kmers", benchKmers},
+	{"revcomp", benchRevComp},
+	{"hpc", benchHpc},
+	{"hashprobs", benchHashProbs},
+	{"postings", benchPostings},
+	{"mindb", benchMinDB},
+    };
+
+    if (argc < 2 || benchmarks.find(argv[1]) == benchmarks.end()) {
+	std::cerr << "Available benchmarks:";
+	for (auto& b : benchmarks) {
+	    std::cerr << " " << b.first;
+	}
+	std::cerr << std::endl;
+	return 1;
+    }
+    return benchmarks[argv[1]](argc, argv);
+}
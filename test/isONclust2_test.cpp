@@ -1,17 +1,38 @@
+#include <unistd.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
+#include "arena.h"
+#include "batch_file.h"
 #include "cluster.h"
+#include "consensus.h"
+#include "decompress.h"
+#include "fastq_reader.h"
 #include "gtest/gtest.h"
 #include "hpc.h"
 #include "kmer_index.h"
 #include "minimizer.h"
+#include "out_buffer.h"
 #include "output.h"
 #include "p_emp_prob.h"
+#include "packed_seq.h"
 #include "parasail.h"
 #include "qualscore.h"
+#include "read_store.h"
 #include "seq.h"
+#include "sort_stream.h"
+#include "util.h"
+#include "zlib.h"
+
+extern std::unique_ptr<spoa::AlignmentEngine> SpoaEngine;
 
 // Test sequence sorting.
 TEST(SortingTest, SortingTest)
@@ -54,6 +75,247 @@ TEST(MinimizerTest, MinimizerTest)
 			       Minimizer{KmerToIndex(cc, cc.end()), 3, 1},
 			       Minimizer{KmerToIndex(at, at.end()), 6, 2}};
     EXPECT_EQ(min, valid_result);
+
+    // Repeated minima leaving the window, and a window past the end.
+    KmerSeq kmers{3, 1, 2, 1, 1, 0, 5, 0, 0, 4, 4, 4, 4, 2, 3, 2, 3};
+    Minimizers repeats{{1, 1, 0}, {0, 5, 1}, {0, 7, 2},
+		       {0, 8, 3}, {4, 9, 4}, {2, 13, 5}};
+    EXPECT_EQ(GetKmerMinimizers(kmers, 2, 5), repeats);
+    EXPECT_EQ(GetKmerMinimizers(KmerSeq{5, 2, 7}, 2, 10),
+	      (Minimizers{{2, 1, 0}}));
+}
+
+// Test that the rolling k-mer encoder matches encoding every k-mer on its
+// own, also with other characters and 64-bit k-mers.
+TEST(KmerRollTest, KmerRollTest)
+{
+    std::string seq = "ACGTTGCAAGGCTTACGATCGGATCCATGCAGGNACCATGGATTACA";
+    for (unsigned k : {1u, 5u, 16u, 20u}) {
+	auto kmers = KmerEncodeSeq(seq, k);
+	ASSERT_EQ(kmers.size(), seq.size() - k);
+	for (unsigned i = 0; i < kmers.size(); i++) {
+	    auto kmer = seq.substr(i, k);
+	    EXPECT_EQ(kmers[i], KmerToIndex(kmer, kmer.end()));
+	}
+	EXPECT_EQ(KmerEncodeSeq(PackedSeq(seq), k), kmers);
+    }
+    EXPECT_TRUE(KmerEncodeSeq(std::string("ACG"), 5).empty());
+    EXPECT_EQ(KmerEncodeRevComp(PackedSeq(seq), 5),
+	      KmerEncodeSeq(RevComp(seq), 5));
+    // Longer k-mers keep the code of their last 16 bases.
+    EXPECT_EQ(KmerEncodeSeq(seq, 20)[3], KmerEncodeSeq(seq.substr(4), 16)[3]);
+}
+
+// Test the compact minimizer encoding and its raw fallback.
+TEST(MinimizerCodecTest, MinimizerCodecTest)
+{
+    std::string seq = "ACGTTGCAAGGCTTACGATCGGATCCATGCAGGTACCATGGATTACA";
+    auto mins = GetKmerMinimizers(KmerEncodeSeq(seq, 13), 13, 16);
+    std::string enc;
+    EncodeMinimizers(mins, 13, enc);
+    EXPECT_EQ(enc[0], char(MINS_PACKED));
+    EXPECT_LT(enc.size(), mins.size() * sizeof(Minimizer));
+    Minimizers dec;
+    auto end = enc.data() + enc.size();
+    EXPECT_EQ(DecodeMinimizers(enc.data(), end, mins.size(), dec), end);
+    EXPECT_EQ(dec, mins);
+    EXPECT_EQ(DecodeMinimizers(enc.data(), end - 1, mins.size(), dec),
+	      nullptr);
+
+    Minimizers odd{{1, 2, 3}, {4, 1, 6}};
+    enc.clear();
+    EncodeMinimizers(odd, 13, enc);
+    EXPECT_EQ(enc[0], char(MINS_RAW));
+    end = enc.data() + enc.size();
+    EXPECT_EQ(DecodeMinimizers(enc.data(), end, odd.size(), dec), end);
+    EXPECT_EQ(dec, odd);
+}
+
+// Test that scratch space from an arena gives the same k-mers and hits.
+TEST(ArenaTest, ArenaTest)
+{
+    Arena arena(64);
+    auto p = arena.Allocate(3, 1);
+    auto q = arena.Allocate(8, 8);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(q) % 8, 0u);
+    EXPECT_NE(p, q);
+    EXPECT_EQ(arena.Used(), 11u);
+    arena.Allocate(100, 8);
+    auto capacity = arena.Capacity();
+    arena.Reset();
+    EXPECT_EQ(arena.Used(), 0u);
+    EXPECT_EQ(arena.Capacity(), capacity);
+
+    std::string seq = "ACGTTGCAAGGCTTACGATCGGATCCATGCA";
+    auto kmers = KmerEncodeSeq(PackedSeq(seq), 5, &arena);
+    EXPECT_EQ(kmers, KmerEncodeSeq(seq, 5));
+    auto mins = GetKmerMinimizers(kmers, 5, 8);
+    MinimizerDB db;
+    AddMinimizers(mins, 3, db);
+    auto hits = GetMinimizerHits(mins, Minimizers(), db, &arena);
+    auto heapHits = GetMinimizerHits(mins, Minimizers(), db);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_EQ(hits.begin()->second.size(),
+	      heapHits.at(std::make_pair(3, 1)).size());
+    EXPECT_GT(arena.Used(), 0u);
+}
+
+// Test that canonical minimizers of a read and its reverse complement hit
+// each other on the reverse strand only.
+TEST(CanonicalMinimizerTest, CanonicalMinimizerTest)
+{
+    std::string seq =
+	"ACGTTGCAAGGCTTACGATCGGATCCATGCAGGTACCATGGATTACAGGCATTCAGGA";
+    unsigned k = 7;
+    KmerStrands strands;
+    auto kmers = KmerEncodeCanonical(PackedSeq(seq), k, strands);
+    auto fwd = KmerEncodeSeq(seq, k);
+    auto rev = KmerEncodeSeq(RevComp(seq), k);
+    ASSERT_EQ(kmers.size(), fwd.size());
+    for (unsigned i = 1; i < kmers.size(); i++) {
+	auto r = rev[seq.size() - k - i];
+	EXPECT_EQ(kmers[i], std::min(fwd[i], r));
+	EXPECT_EQ(strands[i], r < fwd[i] ? -1 : 1);
+    }
+    auto withN = seq;
+    withN[10] = 'N';
+    kmers = KmerEncodeCanonical(PackedSeq(withN), k, strands);
+    EXPECT_EQ(kmers[5], KmerEncodeSeq(withN, k)[5]);
+    EXPECT_EQ(strands[5], 1);
+
+    Seq read("Foo", seq, std::string(seq.size(), 'I'), 0.0);
+    auto rc = RevComp(seq);
+    Seq revRead("Bar", rc, std::string(rc.size(), 'I'), 0.0);
+    Minimizers mins, revMins, qMins, qRevMins;
+    SeqMinimizers(read, k, 10, true, false, mins, revMins);
+    SeqMinimizers(revRead, k, 10, true, false, qMins, qRevMins);
+    EXPECT_TRUE(revMins.empty());
+    MinimizerDB db;
+    AddMinimizers(mins, 2, db);
+    auto hits = GetMinimizerHits(qMins, qRevMins, db);
+    EXPECT_EQ(hits.count(std::make_pair(2, 1)), 0u);
+    EXPECT_GE(hits.at(std::make_pair(2, -1)).size(), mins.size() - 2);
+
+    std::string enc;
+    EncodeMinimizers(mins, k, enc);
+    EXPECT_EQ(enc[0], char(MINS_PACKED_STRANDED));
+    Minimizers dec;
+    auto end = enc.data() + enc.size();
+    EXPECT_EQ(DecodeMinimizers(enc.data(), end, mins.size(), dec), end);
+    EXPECT_EQ(dec, mins);
+    EXPECT_EQ(sizeof(Minimizer), 12u);
+    KmerEncodeCanonical(PackedSeq(seq), k, strands);
+    for (unsigned i = 0; i < dec.size(); i++) {
+	EXPECT_EQ(MinIndex(dec[i]), i);
+	EXPECT_EQ(MinStrand(dec[i]), int(strands[dec[i].Pos]));
+    }
+}
+
+// Test masking of frequent minimizers.
+TEST(MinimizerMaskTest, MinimizerMaskTest)
+{
+    MinimizerDB db;
+    PostingCounts counts;
+    for (unsigned c = 0; c < 20; c++) {
+	Minimizers mins{{5, 0, 0}};
+	if (c < 5) {
+	    mins.push_back(Minimizer{9, 10, 1});
+	}
+	if (c == 0) {
+	    mins.push_back(Minimizer{7, 20, 2});
+	}
+	AddMinimizers(mins, c, db, &counts);
+    }
+    EXPECT_EQ(counts.NrKeys(), 3u);
+    EXPECT_EQ(counts.Cutoff(0.0), 0u);
+    EXPECT_EQ(counts.Cutoff(15.0), 15u);
+    EXPECT_GE(counts.Cutoff(0.1), 20u);
+    EXPECT_EQ(counts.Cutoff(0.34), unsigned(MASK_MIN_POSTINGS));
+    EXPECT_EQ(PostingCounts(db).Cutoff(0.34), unsigned(MASK_MIN_POSTINGS));
+
+    Minimizers query{{5, 0, 0}, {9, 10, 1}, {7, 20, 2}};
+    EXPECT_EQ(GetMinimizerHits(query, Minimizers(), db).size(), 20u);
+    auto hits = GetMinimizerHits(query, Minimizers(), db, nullptr,
+				 counts.Cutoff(0.34));
+    EXPECT_EQ(hits.size(), 5u);
+    EXPECT_EQ(hits.at(std::make_pair(0, 1)).size(), 2u);
+
+    UpdateMinDB(0, Minimizers{{5, 0, 0}, {9, 10, 1}, {7, 20, 2}},
+		Minimizers{{5, 0, 0}, {9, 10, 1}}, db, &counts);
+    EXPECT_EQ(counts.NrKeys(), 2u);
+}
+
+// Test the minimizer database against a map of vectors.
+TEST(MinimizerDBTest, MinimizerDBTest)
+{
+    MinimizerDB db;
+    EXPECT_TRUE(db.Find(3).empty());
+    std::map<unsigned, std::vector<unsigned>> ref;
+    std::mt19937 rng(7);
+    for (unsigned i = 0; i < 200000; i++) {
+	// Few keys get long lists, many stay inline.
+	auto key = (rng() % 4 == 0) ? rng() % 50 : rng();
+	auto posting = rng() % 1000;
+	auto& r = ref[key];
+	switch (rng() % 4) {
+	    case 0:
+		db.Append(key, posting);
+		r.push_back(posting);
+		break;
+	    case 1:
+		db.Insert(key, posting);
+		r.insert(std::upper_bound(r.begin(), r.end(), posting),
+			 posting);
+		break;
+	    case 2:
+		db.Erase(key, posting);
+		r.erase(std::remove(r.begin(), r.end(), posting), r.end());
+		if (!db.Contains(key)) {
+		    ref.erase(key);
+		}
+		break;
+	    default:
+		db.Assign(key, r.data(), r.size());
+	}
+    }
+    EXPECT_EQ(db.Size(), ref.size());
+    for (auto& kv : ref) {
+	auto p = db.Find(kv.first);
+	ASSERT_TRUE(db.Contains(kv.first));
+	EXPECT_EQ(std::vector<unsigned>(p.begin(), p.end()), kv.second);
+    }
+    size_t nrKeys = 0;
+    db.ForEach([&](unsigned key, const PostingList& p) {
+	nrKeys++;
+	EXPECT_EQ(p.size(), ref.at(key).size());
+    });
+    EXPECT_EQ(nrKeys, ref.size());
+
+    MinimizerDB copy(db);
+    EXPECT_EQ(copy, db);
+    copy.Erase(ref.begin()->first, 1000);
+    copy.Append(ref.begin()->first, 1000);
+    EXPECT_FALSE(copy == db);
+    copy.Clear();
+    EXPECT_TRUE(copy.Empty());
+    EXPECT_TRUE(copy.Find(ref.begin()->first).empty());
+
+    // A list longer than an overflow chunk, among many short ones.
+    const unsigned longLen = 3u << (MINDB_CHUNK_BITS - 1);
+    for (unsigned i = 0; i < longLen; i++) {
+	copy.Append(1, i);
+	copy.Append((i % 100000) | 0x80000000u, i);
+    }
+    auto longList = copy.Find(1);
+    ASSERT_EQ(longList.size(), longLen);
+    unsigned nrWrong = 0;
+    for (unsigned i = 0; i < longLen; i++) {
+	nrWrong += unsigned(longList[i] != i);
+    }
+    EXPECT_EQ(nrWrong, 0u);
+    auto shortList = copy.Find(0x80000000u);
+    ASSERT_EQ(shortList.size(), longLen / 100000 + 1);
+    EXPECT_EQ(shortList.back(), longLen / 100000 * 100000);
 }
 
 // Test homopolymer compression.
@@ -64,6 +326,104 @@ TEST(HpcTest, HpcTest)
     auto so = HomopolymerCompress(stmp);
     EXPECT_EQ(so->Str(), "ATGCGTA");
     EXPECT_EQ(so->Qual(), ":?++++@");
+
+    // Long enough for the vector loops, with a run across their blocks.
+    std::string seq = "ACCGTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTGAANNC";
+    std::string qual(seq.size(), '+');
+    qual[20] = 'I';
+    std::string outSeq(seq.size(), 0);
+    std::string outQual(seq.size(), 0);
+    auto n = CompressRuns(seq.data(), qual.data(), unsigned(seq.size()),
+			  &outSeq[0], &outQual[0]);
+    EXPECT_EQ(outSeq.substr(0, n), "ACGTGANC");
+    EXPECT_EQ(outQual.substr(0, n), "+++I++++");
+
+    // Packed reads and reads with exceptions against a plain loop, with
+    // runs ending on and across block boundaries.
+    std::mt19937 rng(3);
+    Arena arena;
+    for (unsigned len = 0; len < 80; len++) {
+	std::string bases(len, 'A');
+	std::string quals(len, '!');
+	// Odd lengths get exceptions.
+	auto nrBases = len % 2 ? 5 : 4;
+	for (unsigned i = 0; i < len; i++) {
+	    bases[i] = (i > 0 && rng() % 3 > 0) ? bases[i - 1]
+						: "ACGTN"[rng() % nrBases];
+	    quals[i] = char('!' + rng() % 40);
+	}
+	std::string expSeq;
+	std::string expQual;
+	for (unsigned i = 0; i < len; i++) {
+	    if (i == 0 || bases[i] != bases[i - 1]) {
+		expSeq += bases[i];
+		expQual += quals[i];
+	    }
+	    expQual.back() = std::max(expQual.back(), quals[i]);
+	}
+	Seq read("Foo", bases, quals, 0.0);
+	auto hpc = HomopolymerCompressObj(read, &arena);
+	EXPECT_EQ(hpc.Str(), expSeq);
+	EXPECT_EQ(hpc.Qual(), expQual);
+    }
+}
+
+// Test reverse complements of IUPAC codes, in place and across the
+// vector blocks.
+TEST(RevCompTest, RevCompTest)
+{
+    EXPECT_EQ(RevComp("ACGTN"), "NACGT");
+    EXPECT_EQ(RevComp("acgtRYKMBVDHSWU-"), "-AWSDHBVKMRYacgt");
+    EXPECT_EQ(RevComp(""), "");
+    std::string seq;
+    for (unsigned i = 0; i < 77; i++) {
+	seq += "ACGTNacgt"[(i * 7) % 9];
+	auto rc = RevComp(seq);
+	auto inPlace = seq;
+	RevCompInPlace(inPlace);
+	EXPECT_EQ(inPlace, rc);
+	EXPECT_EQ(RevComp(rc), seq);
+	EXPECT_EQ(rc.front(), RevComp(seq.substr(i))[0]);
+    }
+}
+
+// Test that packed sequences keep other characters and encode k-mers and
+// homopolymer runs like the plain strings.
+TEST(PackedSeqTest, PackedSeqTest)
+{
+    std::string str = "ACGTNNacGTTTRYAAAAC";
+    PackedSeq p(str);
+    EXPECT_EQ(p.Len(), str.size());
+    EXPECT_EQ(p.Unpack(), str);
+    EXPECT_EQ(p.Bytes().size(), 5u);
+    EXPECT_EQ(p.Exceptions().size(), 6u);
+    EXPECT_EQ(p.Code(2), 2);
+    EXPECT_EQ(p.Code(4), -1);
+    EXPECT_EQ(KmerEncodeSeq(p, 5), KmerEncodeSeq(str, 5));
+    EXPECT_EQ(PackedSeq(std::string()).Unpack(), "");
+
+    std::unique_ptr<Seq> s(
+	new Seq("Foo", str, std::string(str.size(), 'I'), 0.0));
+    auto so = std::unique_ptr<Seq>(HomopolymerCompress(s));
+    EXPECT_EQ(so->Str(), "ACGTNacGTRYAC");
+}
+
+// Test the reduced quality representations.
+TEST(QualStoreTest, QualStoreTest)
+{
+    std::string qual = "!#%+5?IS";
+    QualStore q(qual);
+    EXPECT_EQ(q.Str(), qual);
+    q.Bin();
+    EXPECT_EQ(q.Kind(), QualBinned);
+    EXPECT_EQ(q.Data().size(), 4u);
+    EXPECT_EQ(q.Str(), "\"\"%+4@IO");
+    q.Drop();
+    EXPECT_EQ(q.Len(), 8u);
+    EXPECT_EQ(q.Str(), "");
+    auto c = QualStore::Const('+', 5);
+    EXPECT_EQ(c.Data().size(), 1u);
+    EXPECT_EQ(c.Str(), "+++++");
 }
 
 // Test error rate calculation.
@@ -81,6 +441,39 @@ TEST(EmpProbLookupTest, EmpProbLookupTest)
     EXPECT_DOUBLE_EQ(res, 0.11736487779693013);
 }
 
+// Test that the hash order is a permutation of the k-mers, finds the same
+// reads and comes with its own probabilities.
+TEST(HashOrderTest, HashOrderTest)
+{
+    std::set<unsigned> hashes;
+    for (unsigned kmer = 0; kmer < 1024; kmer++) {
+	hashes.insert(HashKmer(kmer, 5));
+    }
+    EXPECT_EQ(hashes.size(), 1024u);
+    EXPECT_LT(*hashes.rbegin(), 1024u);
+
+    std::string seq =
+	"ACGTTGCAAGGCTTACGATCGGATCCATGCAGGTACCATGGATTACAGGCATTCAGGA";
+    Seq read("Foo", seq, std::string(seq.size(), 'I'), 0.0);
+    Minimizers mins, revMins, lexMins, lexRevMins;
+    SeqMinimizers(read, 7, 10, false, true, mins, revMins);
+    SeqMinimizers(read, 7, 10, false, false, lexMins, lexRevMins);
+    EXPECT_NE(mins, lexMins);
+    MinimizerDB db;
+    AddMinimizers(mins, 4, db);
+    auto hits = GetMinimizerHits(mins, revMins, db);
+    EXPECT_EQ(hits.at(std::make_pair(4, 1)).size(), mins.size());
+
+    auto lex = InitMinSharedMap(13, 20);
+    auto hashed = InitMinSharedMap(13, 20, true);
+    ASSERT_EQ(hashed.size(), lex.size());
+    auto p = GetPMinShared(0.05, 0.05, hashed);
+    EXPECT_GT(p, 0.8 * GetPMinShared(0.05, 0.05, lex));
+    EXPECT_LT(p, 1.1 * GetPMinShared(0.05, 0.05, lex));
+    EXPECT_EQ(GetPMinShared(0.02, 0.07, hashed),
+	      GetPMinShared(0.07, 0.02, hashed));
+}
+
 // Test minimizer matching.
 TEST(MinMatchTest, MinMatchTest)
 {
@@ -115,7 +508,7 @@ TEST(MinMatchTest, MinMatchTest)
     auto readMins = GetKmerMinimizers(KmerEncodeSeq(readHpc->Str(), kmerSize),
 				      kmerSize, windowSize);
     auto hits = GetMinimizerHits(readMins, Minimizers(), minDB);
-    Clusters cls;
+    ClusterStore cls;
     auto hitOrder = SortMinimizerHits(hits, cls);
 
     EXPECT_EQ(hitOrder[0]->Size, 14);
@@ -180,6 +573,35 @@ TEST(AlnRatioTest, AlnRatioTest)
     EXPECT_DOUBLE_EQ(alnRatio, 0.7111111111111111);
 }
 
+// Test that reads matching the reverse strand of a cluster are added to its
+// consensus complemented.
+TEST(ConsensusStrandTest, ConsensusStrandTest)
+{
+    SpoaEngine = spoa::AlignmentEngine::Create(spoa::AlignmentType::kNW, 4,
+					       -8, -8, -4, -20, -1);
+    std::string seq =
+	"ACGTTGCAAGGCTTACGATCGGATCCATGCAGGTACCATGGATTACAGGCATTCAGGA";
+    auto qual = std::string(seq.size(), 'I');
+    ProcSeq rep{SeqUptr(new Seq("rep", seq, qual, 0.0)),
+		SeqUptr(new Seq("rep", seq, qual, 0.0)), Minimizers{},
+		Minimizers{}, 1, 0};
+    rep.RawSeq->SetErrorRate(0.01);
+    rep.HpcSeq->SetErrorRate(0.01);
+    spoa::Graph graph;
+    AddSeqToGraph(seq, &graph, SpoaEngine.get(), 1);
+
+    // Two reads outweigh the representative unless they are complemented.
+    std::string name = "cons";
+    auto read = RevComp(seq);
+    for (int i = 0; i < 2; i++) {
+	EXPECT_TRUE(UpdateClusterConsensus(name, rep, &graph, nullptr, read,
+					   0.01, 0.01, -1, 2, 150, 7, 10,
+					   false, false));
+    }
+    EXPECT_EQ(rep.RawSeq->Str(), seq);
+    EXPECT_EQ(read, RevComp(seq));
+}
+
 // Test kmer transformation.
 TEST(TestKmerTransform, TestKmerTransform)
 {
@@ -202,6 +624,429 @@ TEST(TestKmerTransform, TestKmerTransform)
     EXPECT_EQ(indices, res_indices);
 }
 
+// Test that merging spilled sorted runs reproduces the in-memory stable sort.
+TEST(SortRunsTest, SortRunsTest)
+{
+    std::vector<double> scores{3.0, 1.0, 2.0, 3.0, 5.0, 1.0, 2.0, 0.5, 3.0};
+    SequencesP all;
+    std::vector<std::string> runFiles;
+    for (unsigned c = 0; c < 3; c++) {
+	SequencesP chunk;
+	for (unsigned i = 3 * c; i < 3 * c + 3; i++) {
+	    auto name = "s" + std::to_string(i);
+	    chunk.emplace_back(new Seq(name, "ACGT", "IIII", scores[i]));
+	    all.emplace_back(new Seq(name, "ACGT", "IIII", scores[i]));
+	}
+	SortByQualScores(chunk);
+	auto runFile = "sort_runs_test_" + std::to_string(c) + ".cer";
+	SpillSortedRun(chunk, runFile);
+	runFiles.push_back(runFile);
+    }
+    SortByQualScores(all);
+
+    std::vector<std::string> merged;
+    MergeSortedRuns(runFiles, [&](std::unique_ptr<Seq> s) {
+	merged.push_back(s->Name());
+    });
+    for (auto& f : runFiles) {
+	std::remove(f.c_str());
+    }
+
+    ASSERT_EQ(merged.size(), all.size());
+    for (unsigned i = 0; i < all.size(); i++) {
+	EXPECT_EQ(merged[i], all[i]->Name());
+    }
+}
+
+// Test that batches built through the flow graph keep the sorted read order.
+TEST(BatchBuilderTest, BatchBuilderTest)
+{
+    std::string dir = "batch_builder_test";
+    CreateOutdir(dir);
+    auto qualTab = InitQualTab();
+    auto qualTabNomin = InitQualTabNomin();
+    CmdArgs args;
+    args.BatchMaxSeq = 2;
+    args.BatchesInFlight = 1;
+
+    std::string read = "ACGTTGCAAGCTTCGATCGGATCCATGCATGCAAGGTTCC"
+		       "AAGGTTACGATCGATCGTAGCT";
+    SequencesP seqs;
+    for (unsigned i = 0; i < 5; i++) {
+	seqs.emplace_back(new Seq("r" + std::to_string(i), read,
+				  std::string(read.size(), 'I'), 0.0));
+    }
+    FillQualScores(seqs, args.KmerSize, args.WindowSize, qualTab,
+		   qualTabNomin);
+
+    int nrBatches;
+    {
+	BatchBuilder builder(args, dir, qualTab, qualTabNomin);
+	for (auto& s : seqs) {
+	    builder.Add(std::move(s));
+	}
+	builder.Finish();
+	nrBatches = builder.NrBatches();
+    }
+    ASSERT_EQ(nrBatches, 3);
+
+    unsigned long long next = 0;
+    for (int i = 0; i < nrBatches; i++) {
+	auto file = dir + "/isONbatch_" + std::to_string(i) + ".cer";
+	auto b = LoadBatch(file);
+	std::remove(file.c_str());
+	EXPECT_EQ(b->BatchNr, i);
+	EXPECT_EQ(b->BatchStart, next);
+	for (unsigned c = 0; c < b->Cls.Size(); c++) {
+	    auto& r = b->Cls.Rep(c);
+	    EXPECT_EQ(r->Id, next);
+	    EXPECT_TRUE(r->RawSeq->Name().empty());
+	    EXPECT_EQ(r->RawSeq->Quals().Kind(), QualNone);
+	    EXPECT_EQ(b->Cls.NrMembers(c), 0u);
+	    next++;
+	}
+	EXPECT_EQ(b->BatchEnd, next - 1);
+    }
+    EXPECT_EQ(next, 5ull);
+    rmdir(dir.c_str());
+}
+
+// Test that batch boundaries computed up front match the incremental ones.
+TEST(BatchBoundariesTest, BatchBoundariesTest)
+{
+    CmdArgs args;
+    args.BatchSize = 1;
+    args.BatchMaxSeq = 3;
+    SequencesP seqs;
+    std::vector<unsigned> lens{400, 700, 10, 10, 10, 10, 900, 200};
+    for (unsigned i = 0; i < lens.size(); i++) {
+	std::string s(lens[i], 'A');
+	seqs.emplace_back(new Seq("r" + std::to_string(i), s, s, 0.0));
+    }
+    std::vector<size_t> expected{0, 2, 5, 8};
+    EXPECT_EQ(BatchBoundaries(seqs, args), expected);
+
+    args.BatchMaxSeq = 0;
+    expected = std::vector<size_t>{0, 2, 8};
+    EXPECT_EQ(BatchBoundaries(seqs, args), expected);
+}
+
+// Test that the batches in flight follow the memory budget.
+TEST(BatchesInFlightTest, BatchesInFlightTest)
+{
+    CmdArgs args;
+    args.BatchesInFlight = 8;
+    EXPECT_EQ(MaxBatchesInFlight(args), 8);
+
+    auto footprint = BatchFootprint(args);
+    EXPECT_GT(footprint, (unsigned long long)(args.BatchSize) * 1000);
+    // Half of the budget holds four batches: three in flight and the one
+    // of the caller.
+    args.MemBudget = int(8 * footprint / (1024 * 1024)) + 1;
+    EXPECT_EQ(MaxBatchesInFlight(args), 3);
+    args.MemBudget *= 4;
+    EXPECT_EQ(MaxBatchesInFlight(args), 8);
+    args.BatchSize /= 4;
+    args.BatchesInFlight = 100;
+    EXPECT_EQ(MaxBatchesInFlight(args), 63);
+    // A budget too small for one batch leaves it to the caller.
+    args.MemBudget = 1;
+    EXPECT_EQ(MaxBatchesInFlight(args), 0);
+}
+
+// Test fastq record boundary detection and chunked parsing.
+TEST(FastqReaderTest, FastqReaderTest)
+{
+    std::string fq =
+	"@r0 comment\nACGT\n+\n@III\n"
+	"@r1\nAC\n+\n+@\n"
+	"@r2\nGGT\n+\nIII";
+
+    // The quality line of r0 starts with '@' but is not a record start.
+    EXPECT_EQ(FindRecordStart(fq.data(), 1, fq.size()), 24u);
+
+    SequencesP seqs;
+    auto used = FastqReader::ParseRecords(fq.data(), fq.size(), false, seqs);
+    EXPECT_EQ(used, 36u);
+    ASSERT_EQ(seqs.size(), 2u);
+    EXPECT_EQ(seqs[0]->Name(), "r0");
+    EXPECT_EQ(seqs[0]->Qual(), "@III");
+    EXPECT_EQ(seqs[1]->Str(), "AC");
+
+    seqs.clear();
+    used = FastqReader::ParseRecords(fq.data(), fq.size(), true, seqs);
+    EXPECT_EQ(used, fq.size());
+    ASSERT_EQ(seqs.size(), 3u);
+    EXPECT_EQ(seqs[2]->Str(), "GGT");
+    EXPECT_EQ(seqs[2]->Qual(), "III");
+}
+
+// Test parsing of gzipped fastq input.
+TEST(GzipInputTest, GzipInputTest)
+{
+    std::string fq = "@r0\nACGT\n+\nIIII\n@r1\nGGC\n+\nIII\n";
+    std::string gzFile = "gzip_input_test.fq.gz";
+    auto gz = gzopen(gzFile.c_str(), "wb");
+    gzwrite(gz, fq.data(), unsigned(fq.size()));
+    gzclose(gz);
+
+    unsigned char bgzf[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0,
+			      0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0};
+    EXPECT_TRUE(IsBgzfHeader(bgzf, sizeof(bgzf)));
+    bgzf[12] = 'X';
+    EXPECT_FALSE(IsBgzfHeader(bgzf, sizeof(bgzf)));
+
+    auto seqs = ParseFastqParallel(gzFile);
+    std::remove(gzFile.c_str());
+    ASSERT_EQ(seqs.size(), 2u);
+    EXPECT_EQ(seqs[0]->Str(), "ACGT");
+    EXPECT_EQ(seqs[1]->Name(), "r1");
+    EXPECT_EQ(seqs[1]->Qual(), "III");
+}
+
+// Test reading several fastq files and directories in a fixed order.
+TEST(MultiFastqTest, MultiFastqTest)
+{
+    std::string dir = "multi_fastq_test";
+    CreateOutdir(dir);
+    std::vector<std::string> files;
+    for (unsigned i = 0; i < 3; i++) {
+	files.push_back(dir + "/chunk_" + std::to_string(i) + ".fastq");
+	std::ofstream out(files.back());
+	for (unsigned j = 0; j < 2; j++) {
+	    out << "@r" << i << "_" << j << "\nACGT\n+\nIIII\n";
+	}
+    }
+    std::ofstream(dir + "/notes.txt") << "not a fastq file" << std::endl;
+
+    auto inputs = ExpandFastqInputs(std::vector<std::string>{dir});
+    EXPECT_EQ(inputs, files);
+
+    std::vector<std::string> names;
+    MultiFastqReader reader(inputs);
+    for (auto seqs = reader.Parse(40); seqs.size() > 0;
+	 seqs = reader.Parse(40)) {
+	for (auto& s : seqs) {
+	    names.push_back(s->Name());
+	}
+    }
+    std::vector<std::string> expected{"r0_0", "r0_1", "r1_0",
+				      "r1_1", "r2_0", "r2_1"};
+    EXPECT_EQ(names, expected);
+
+    // Compressed files are grouped by their decompressed size.
+    std::vector<std::string> gzFiles;
+    for (unsigned i = 0; i < 3; i++) {
+	gzFiles.push_back(dir + "/chunk_" + std::to_string(i) + ".fq.gz");
+	std::string fq;
+	for (unsigned j = 0; j < 2; j++) {
+	    fq += "@g" + std::to_string(i) + "_" + std::to_string(j) + "\n" +
+		  std::string(100, 'A') + "\n+\n" + std::string(100, 'I') +
+		  "\n";
+	}
+	auto gz = gzopen(gzFiles.back().c_str(), "wb");
+	gzwrite(gz, fq.data(), unsigned(fq.size()));
+	gzclose(gz);
+	EXPECT_EQ(InputSize(gzFiles.back()), fq.size());
+    }
+    std::vector<size_t> chunkSizes;
+    MultiFastqReader gzReader(gzFiles);
+    for (auto seqs = gzReader.Parse(500); seqs.size() > 0;
+	 seqs = gzReader.Parse(500)) {
+	chunkSizes.push_back(seqs.size());
+    }
+    EXPECT_EQ(chunkSizes, (std::vector<size_t>{2, 2, 2}));
+    files.insert(files.end(), gzFiles.begin(), gzFiles.end());
+
+    for (auto& f : files) {
+	std::remove(f.c_str());
+    }
+    std::remove((dir + "/notes.txt").c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that buffered output matches std::ostream formatting.
+TEST(OutBufferTest, OutBufferTest)
+{
+    std::ostringstream expected;
+    for (bool async : {false, true}) {
+	std::string outFile = "out_buffer_test.tsv";
+	OutBuffer out;
+	CreateFile(outFile, out, async);
+	expected.str("");
+	for (int i = -3; i < 20000; i++) {
+	    double score = i * 1234.5678;
+	    out << "r" << i << '\t' << (unsigned long long)(i + 3) << '\t'
+		<< score << '\n';
+	    expected << "r" << i << '\t' << (unsigned long long)(i + 3) << '\t'
+		     << score << '\n';
+	}
+	out.Close();
+
+	std::ifstream in(outFile);
+	std::stringstream got;
+	got << in.rdbuf();
+	std::remove(outFile.c_str());
+	EXPECT_EQ(got.str(), expected.str());
+    }
+}
+
+// Test random access to reads in the packed read store.
+TEST(ReadStoreTest, ReadStoreTest)
+{
+    std::string storeFile = "read_store_test.isrs";
+    SequencesP seqs;
+    seqs.emplace_back(new Seq("r0", "ACGTTGCA", "IIIIIIII", 2.5));
+    seqs.emplace_back(new Seq("r1", "ACNNRYacgtT", "!#%&()*+,-.", -1.0));
+    seqs.emplace_back(new Seq("r2", "G", "5", 0.0));
+    seqs.emplace_back(new Seq("r3", std::string(1000, 'T'),
+			      std::string(1000, '?'), 7.0));
+    {
+	ReadStoreWriter writer(storeFile);
+	for (auto& s : seqs) {
+	    writer.Add(*s);
+	}
+	EXPECT_EQ(writer.NrReads(), 4ull);
+    }
+
+    ReadStore store(storeFile);
+    ASSERT_EQ(store.NrReads(), seqs.size());
+    for (int i = int(seqs.size()) - 1; i >= 0; i--) {
+	auto s = store.Get(i);
+	EXPECT_EQ(s->Name(), seqs[i]->Name());
+	EXPECT_EQ(s->Str(), seqs[i]->Str());
+	EXPECT_EQ(s->Qual(), seqs[i]->Qual());
+	EXPECT_EQ(s->Score(), seqs[i]->Score());
+	EXPECT_EQ(store.Name(i), seqs[i]->Name());
+    }
+    std::remove(storeFile.c_str());
+}
+
+// Test that a batch survives the flat batch file round trip.
+TEST(BatchFileTest, BatchFileTest)
+{
+    std::string batchFile = "batch_file_test.cer";
+    auto b = std::unique_ptr<Batch>(new Batch);
+    b->BatchNr = 3;
+    b->BatchStart = 10;
+    b->BatchEnd = 12;
+    b->BatchBases = 42;
+    b->Depth = 2;
+    b->LeftLeaf = "left.cer";
+    b->SortArgs.KmerSize = 13;
+
+    auto raw = SeqUptr(new Seq("r10", "AACCGGTT", "IIIIIIII", 3.5));
+    raw->SetErrorRate(0.01);
+    auto hpc = SeqUptr(new Seq("r10", "ACGT", "", 3.5));
+    hpc->SetQual(QualStore::Const('I', 4));
+    auto p0 = std::make_shared<ProcSeq>(
+	ProcSeq{std::move(raw), std::move(hpc), Minimizers{{1, 2, 3}, {4, 5, 6}},
+		Minimizers{{7, 8, 9}}, -1, 10});
+    auto p1 = std::make_shared<ProcSeq>(
+	ProcSeq{nullptr, nullptr, Minimizers{}, Minimizers{}, 0, 11});
+    b->Cls.Add(p0);
+    b->Cls.AddMember(0, 11, 1);
+    b->Cls.Add(p1);
+    b->Cls.AddMember(0, 12, -1);
+    b->NrCls = int(b->Cls.Size());
+    b->MinDB.Append(5, 0);
+    b->MinDB.Append(5, 1);
+    b->MinDB.Append(9, 1);
+    SaveBatch(b, batchFile);
+
+    auto partial = LoadBatch(batchFile, BATCH_LOAD_CLUSTERS);
+    EXPECT_EQ(partial->Cls.Size(), 2u);
+    EXPECT_TRUE(partial->MinDB.Empty());
+    BatchFile file(batchFile);
+    auto summary = file.Summary();
+    EXPECT_EQ(summary.NrClusters, 1u);
+    EXPECT_EQ(summary.NrNontrivialClusters, 1u);
+    EXPECT_EQ(summary.MinDBSize, 2u);
+    EXPECT_EQ(summary.NrMembers, 2u);
+
+    auto l = LoadBatch(batchFile);
+    std::remove(batchFile.c_str());
+    EXPECT_EQ(l->BatchNr, 3);
+    EXPECT_EQ(l->BatchStart, 10ull);
+    EXPECT_EQ(l->BatchEnd, 12ull);
+    EXPECT_EQ(l->BatchBases, 42ull);
+    EXPECT_EQ(l->Depth, 2);
+    EXPECT_EQ(l->LeftLeaf, "left.cer");
+    EXPECT_EQ(l->SortArgs.KmerSize, 13);
+    ASSERT_EQ(l->Cls.Size(), 2u);
+    ASSERT_EQ(l->Cls.NrMembers(0), 2u);
+    EXPECT_EQ(l->Cls.NrMembers(1), 0u);
+    auto& q = l->Cls.Rep(0);
+    EXPECT_EQ(q->Id, 10ull);
+    EXPECT_EQ(q->RawSeq->Name(), "r10");
+    EXPECT_EQ(q->MatchStrand, -1);
+    EXPECT_EQ(q->RawSeq->Str(), "AACCGGTT");
+    EXPECT_EQ(q->RawSeq->Score(), 3.5);
+    EXPECT_EQ(q->RawSeq->ErrorRate(), 0.01);
+    EXPECT_EQ(q->HpcSeq->Qual(), "IIII");
+    EXPECT_EQ(q->Mins, p0->Mins);
+    EXPECT_EQ(q->RevMins, p0->RevMins);
+    EXPECT_EQ(l->Cls.MemberId(0), 11ull);
+    EXPECT_EQ(l->Cls.MemberId(1), 12ull);
+    EXPECT_EQ(l->Cls.MemberStrand(1), -1);
+    EXPECT_EQ(l->Cls.Rep(1)->RawSeq, nullptr);
+    EXPECT_EQ(l->Cls.Rep(1)->Id, 11ull);
+    EXPECT_EQ(l->MinDB, b->MinDB);
+
+    b->SortArgs.BatchCompression = 1;
+    SaveBatch(b, batchFile);
+    EXPECT_EQ(BatchFile(batchFile).Sections()[3].Codec, uint32_t(CodecZlib));
+    auto z = LoadBatch(batchFile);
+    std::remove(batchFile.c_str());
+    ASSERT_EQ(z->Cls.Size(), 2u);
+    EXPECT_EQ(z->Cls.Rep(0)->RawSeq->Str(), "AACCGGTT");
+    EXPECT_EQ(z->Cls.Rep(0)->RevMins, p0->RevMins);
+    EXPECT_EQ(z->Cls.Rep(1)->Id, 11ull);
+    EXPECT_EQ(z->Cls.MemberId(1), 12ull);
+    EXPECT_EQ(z->MinDB, b->MinDB);
+}
+
+// Test member grouping, merging and reordering in the cluster store.
+TEST(ClusterStoreTest, ClusterStoreTest)
+{
+    ClusterStore right;
+    right.Add(std::make_shared<ProcSeq>());
+    right.Add(std::make_shared<ProcSeq>());
+    right.AddMember(1, 7, 1);
+    right.AddMember(0, 5, -1);
+    right.AddMember(1, 8, -1);
+    EXPECT_FALSE(right.Grouped());
+    right.Group();
+    ASSERT_TRUE(right.Grouped());
+    EXPECT_EQ(right.Offset(1), 1ull);
+    EXPECT_EQ(right.MemberId(0), 5ull);
+    EXPECT_EQ(right.MemberId(1), 7ull);
+    EXPECT_EQ(right.MemberCluster(2), 1u);
+
+    ClusterStore left;
+    left.Add(std::make_shared<ProcSeq>());
+    left.AddMember(0, 1, 1);
+    EXPECT_TRUE(left.Grouped());
+    left.Add(right.Rep(0));
+    left.AddMembers(1, right, 0, false);
+    left.AddMembers(0, right, 1, true);
+    EXPECT_EQ(left.NrMembers(0), 3u);
+    EXPECT_EQ(left.NrMembers(1), 1u);
+    EXPECT_EQ(left.MemberStrand(2), -1);
+    EXPECT_EQ(left.MemberStrand(3), 1);
+
+    left.Permute(std::vector<unsigned>{1, 0});
+    EXPECT_EQ(left.Rep(0), right.Rep(0));
+    EXPECT_EQ(left.NrMembers(0), 1u);
+    EXPECT_EQ(left.MemberId(0), 5ull);
+    std::vector<unsigned long long> ids;
+    for (auto m = left.Offset(1); m < left.Offset(1) + left.NrMembers(1);
+	 m++) {
+	ids.push_back(left.MemberId(m));
+    }
+    EXPECT_EQ(ids, (std::vector<unsigned long long>{1, 7, 8}));
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);